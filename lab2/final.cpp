@@ -4,28 +4,66 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include "render/shader.h"
+#include "render/texture_cache.h"
+#include "render/culling.h"
+#include "render/vertex_format.h"
+#include "render/cascaded_shadows.h"
+#include "render/render_queue.h"
+#include "render/facade_materials.h"
+#include "render/sky_cubemap.h"
+#include "render/impostor_atlas.h"
+#include "render/hiz_occlusion.h"
+#include "world/spatial_grid.h"
+#include "world/city_chunks.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
 #include <vector>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstddef>
 #define _USE_MATH_DEFINES
 #include <math.h>
 
 // ---------- Shadow map globals ----------
-static GLuint depthMapFBO = 0;
-static GLuint depthMap = 0;
-static const unsigned int SHADOW_W = 2048;
-static const unsigned int SHADOW_H = 2048;
+// 3 x 1024^2 cascades: fewer texels than the single 2048^2 map they replace
+static CascadedShadows shadows;
+static const int SHADOW_CASCADES = 3;
+static const int SHADOW_RESOLUTION = 1024;
+
+// PCF kernel compiled into the lit shader: PCF_POISSON (PCF_TAPS of 16 disk taps),
+// PCF_GRID (PCF_GRID_SIZE^2 taps on a rotated grid) or neither for one bilinear compare.
+// PCF_RADIUS is the kernel radius in shadow texels.
+#define SHADOW_FILTER "PCF_POISSON;PCF_TAPS=12;PCF_RADIUS=1.5"
 
 // Depth-only shader program
 static GLuint depthProgram = 0;
-static GLuint depthLightSpaceID = 0;
 static GLuint depthModelID = 0;
-
-// Forward declaration
-static void initShadowMap();
+static GLuint depthCascadeID = 0;
+
+// Same shader writing camera depth, for the pre-pass
+static GLuint prepassProgram = 0;
+static GLuint prepassModelID = 0;
+
+// ---------- Per-frame uniform block ----------
+// Mirrors `FrameUniforms` in lit_box.* and shadow_depth.vert (std140, so vec3s are padded to vec4)
+struct FrameUniforms {
+    glm::mat4 viewProj;
+    glm::vec4 cameraPos;
+    glm::vec4 cameraForward;    // xyz = view direction, for picking a cascade
+    glm::vec4 lightPosition;
+    glm::vec4 lightDirection;   // xyz = towards the light, for shadows
+    glm::vec4 lightIntensity;
+    glm::vec4 fogColorDensity;  // rgb = fog colour, a = density
+    glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];
+    glm::vec4 cascadeSplits;    // view depth where each cascade ends
+    glm::vec4 cascadeBias;      // depth bias per cascade
+    glm::vec4 shadowParams;     // x = cascade count
+};
+static const GLuint FRAME_UNIFORMS_BINDING = 0;
+static GLuint frameUniformBuffer = 0;
 
 static GLFWwindow* window;
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
@@ -41,423 +79,539 @@ static glm::vec3 up(0, 1, 0);
 static glm::vec3 playerPos(0.0f, 0.0f, 0.0f);
 static float yaw = 0.0f; // radians, turn left/right
 
-// ------------------------
-// Texture loaders
-// ------------------------
-static GLuint LoadTextureTileBox(const char* texture_file_path) {
-    int w, h, channels;
-    uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
-    if (!img) {
-        std::cout << "Failed to load texture " << texture_file_path << std::endl;
-        return 0;
-    }
+// I toggles between the instanced batch and per-building draws (for comparison)
+static bool useInstancing = true;
 
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+// P toggles the camera depth pre-pass: with it the lit shader runs once per visible pixel
+static bool useDepthPrepass = true;
 
-    // Tile on box
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+// ---------- Building LOD ----------
+// The distance from the camera to a building's box picks how it is drawn: the full lit
+// shader, the lit shader with a single shadow compare instead of PCF, or an impostor
+// quad. L switches LOD off (everything full); [ and ] scale both distances.
+static bool useLod = true;
+static float lodMidDistance = 300.0f;
+static float lodImpostorDistance = 600.0f;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// O toggles occlusion culling against the previous frame's depth (Hi-Z pyramid)
+static bool useOcclusion = true;
+static HiZOcclusion occlusion;
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
-    glGenerateMipmap(GL_TEXTURE_2D);
+// ------------------------
+// Textures (shared, decoded once per file)
+// ------------------------
+static TextureCache textureCache;
 
-    stbi_image_free(img);
-    return texture;
+// Every facade (and the ground) is a layer of one texture array; buildings store the layer
+static FacadeMaterials facadeMaterials;
+static const int FACADE_SIZE = 1024;
+
+// Baked views of the box per facade, for the far LOD tier
+static ImpostorAtlas impostorAtlas;
+
+static void initFrameUniforms() {
+    glGenBuffers(1, &frameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-static GLuint LoadSkyboxTexture(const char* texture_file_path) {
-    int w, h, channels;
+// GL 3.3 has no layout(binding = N) for blocks, so each program is pointed at the slot here
+static void bindFrameUniforms(GLuint programID) {
+    GLuint blockIndex = glGetUniformBlockIndex(programID, "FrameUniforms");
+    if (blockIndex != GL_INVALID_INDEX) glUniformBlockBinding(programID, blockIndex, FRAME_UNIFORMS_BINDING);
+}
 
-    stbi_set_flip_vertically_on_load(true);
-    uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
-    if (!img) {
-        std::cout << "Failed to load skybox texture " << texture_file_path << std::endl;
-        return 0;
-    }
+static void uploadFrameUniforms(const FrameUniforms& frame) {
+    glBindBuffer(GL_UNIFORM_BUFFER, frameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, frameUniformBuffer);
+}
 
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+// ============================================================
+// Shared box mesh
+// ============================================================
+// One interleaved vertex of the box (attribute locations 0 = position, 3 = normal, 2 = uv)
+struct BoxVertex {
+    GLfloat position[3];
+    GLfloat normal[3];
+    GLfloat uv[2];
+};
 
-    // Avoid seams
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+// Box on the XZ plane spanning x,z in [-1, 1] and y in [0, 2]; V is tiled 5 times on the
+// sides. Immutable and uploaded once, then shared by every building and by both passes.
+struct BoxMesh {
+    GLuint vertexArrayID = 0;
+    GLuint vertexBufferID = 0;
+    GLuint indexBufferID = 0;
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    static const int INDEX_COUNT = 36;
+
+    void initialize() {
+        static const BoxVertex vertices[24] = {
+            // Front (0,0,1)
+            {{-1.0f, 0.0f,  1.0f}, { 0.f, 0.f,  1.f}, {0.0f, 5.0f}},
+            {{ 1.0f, 0.0f,  1.0f}, { 0.f, 0.f,  1.f}, {1.0f, 5.0f}},
+            {{ 1.0f, 2.0f,  1.0f}, { 0.f, 0.f,  1.f}, {1.0f, 0.0f}},
+            {{-1.0f, 2.0f,  1.0f}, { 0.f, 0.f,  1.f}, {0.0f, 0.0f}},
+            // Back (0,0,-1)
+            {{ 1.0f, 0.0f, -1.0f}, { 0.f, 0.f, -1.f}, {0.0f, 5.0f}},
+            {{-1.0f, 0.0f, -1.0f}, { 0.f, 0.f, -1.f}, {1.0f, 5.0f}},
+            {{-1.0f, 2.0f, -1.0f}, { 0.f, 0.f, -1.f}, {1.0f, 0.0f}},
+            {{ 1.0f, 2.0f, -1.0f}, { 0.f, 0.f, -1.f}, {0.0f, 0.0f}},
+            // Left (-1,0,0)
+            {{-1.0f, 0.0f, -1.0f}, {-1.f, 0.f,  0.f}, {0.0f, 5.0f}},
+            {{-1.0f, 0.0f,  1.0f}, {-1.f, 0.f,  0.f}, {1.0f, 5.0f}},
+            {{-1.0f, 2.0f,  1.0f}, {-1.f, 0.f,  0.f}, {1.0f, 0.0f}},
+            {{-1.0f, 2.0f, -1.0f}, {-1.f, 0.f,  0.f}, {0.0f, 0.0f}},
+            // Right (1,0,0)
+            {{ 1.0f, 0.0f,  1.0f}, { 1.f, 0.f,  0.f}, {0.0f, 5.0f}},
+            {{ 1.0f, 0.0f, -1.0f}, { 1.f, 0.f,  0.f}, {1.0f, 5.0f}},
+            {{ 1.0f, 2.0f, -1.0f}, { 1.f, 0.f,  0.f}, {1.0f, 0.0f}},
+            {{ 1.0f, 2.0f,  1.0f}, { 1.f, 0.f,  0.f}, {0.0f, 0.0f}},
+            // Top (0,1,0), not textured
+            {{-1.0f, 2.0f,  1.0f}, { 0.f, 1.f,  0.f}, {0.0f, 0.0f}},
+            {{ 1.0f, 2.0f,  1.0f}, { 0.f, 1.f,  0.f}, {0.0f, 0.0f}},
+            {{ 1.0f, 2.0f, -1.0f}, { 0.f, 1.f,  0.f}, {0.0f, 0.0f}},
+            {{-1.0f, 2.0f, -1.0f}, { 0.f, 1.f,  0.f}, {0.0f, 0.0f}},
+            // Bottom (0,-1,0), not textured
+            {{-1.0f, 0.0f, -1.0f}, { 0.f,-1.f,  0.f}, {0.0f, 0.0f}},
+            {{ 1.0f, 0.0f, -1.0f}, { 0.f,-1.f,  0.f}, {0.0f, 0.0f}},
+            {{ 1.0f, 0.0f,  1.0f}, { 0.f,-1.f,  0.f}, {0.0f, 0.0f}},
+            {{-1.0f, 0.0f,  1.0f}, { 0.f,-1.f,  0.f}, {0.0f, 0.0f}},
+        };
+
+        static const GLuint indices[INDEX_COUNT] = {
+            0, 1, 2,   0, 2, 3,        // Front
+            4, 5, 6,   4, 6, 7,        // Back
+            8, 9, 10,  8, 10, 11,      // Left
+            12, 13, 14, 12, 14, 15,    // Right
+            16, 17, 18, 16, 18, 19,    // Top
+            20, 21, 22, 20, 22, 23     // Bottom
+        };
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+        glGenBuffers(1, &vertexBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-    stbi_image_free(img);
-    return texture;
-}
+        glGenBuffers(1, &indexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-static void initShadowMap() {
-    glGenFramebuffers(1, &depthMapFBO);
+        glGenVertexArrays(1, &vertexArrayID);
+        glBindVertexArray(vertexArrayID);
+        bindAttributes();
+        glBindVertexArray(0);
+    }
 
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-                 SHADOW_W, SHADOW_H, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    static VertexFormat vertexFormat() {
+        VertexFormat format(sizeof(BoxVertex));
+        format.add(0, 3, GL_FLOAT, offsetof(BoxVertex, position))
+              .add(3, 3, GL_FLOAT, offsetof(BoxVertex, normal))
+              .add(2, 2, GL_FLOAT, offsetof(BoxVertex, uv));
+        return format;
+    }
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Points the bound VAO at the shared buffers (other VAOs, e.g. the batch's, reuse the mesh)
+    void bindAttributes() const {
+        vertexFormat().apply(vertexBufferID);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+    }
 
-    // Important to reduce border artifacts
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    void cleanup() {
+        glDeleteBuffers(1, &vertexBufferID);
+        glDeleteBuffers(1, &indexBufferID);
+        glDeleteVertexArrays(1, &vertexArrayID);
+    }
+};
 
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
+static BoxMesh boxMesh;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
+// Lit program for the per-building path (the batch uses the INSTANCED variant)
+static GLuint buildingProgram = 0;
+static GLuint buildingModelID = 0;
+static GLuint buildingLayerID = 0;
 
 // ============================================================
 // Building structure
 // ============================================================
+// Transform plus material; the geometry is the shared boxMesh
 struct Building {
     glm::vec3 position;
     glm::vec3 scale;
+    int facadeLayer = 0;    // layer in facadeMaterials
 
-    // Vertex definition for a box on the XZ plane
-    GLfloat vertex_buffer_data[72] = {
-        // Front face
-        -1.0f, 0.0f,  1.0f,
-         1.0f, 0.0f,  1.0f,
-         1.0f, 2.0f,  1.0f,
-        -1.0f, 2.0f,  1.0f,
-
-        // Back face
-         1.0f, 0.0f, -1.0f,
-        -1.0f, 0.0f, -1.0f,
-        -1.0f, 2.0f, -1.0f,
-         1.0f, 2.0f, -1.0f,
-
-        // Left face
-        -1.0f, 0.0f, -1.0f,
-        -1.0f, 0.0f,  1.0f,
-        -1.0f, 2.0f,  1.0f,
-        -1.0f, 2.0f, -1.0f,
-
-        // Right face
-         1.0f, 0.0f,  1.0f,
-         1.0f, 0.0f, -1.0f,
-         1.0f, 2.0f, -1.0f,
-         1.0f, 2.0f,  1.0f,
-
-        // Top face
-        -1.0f, 2.0f,  1.0f,
-         1.0f, 2.0f,  1.0f,
-         1.0f, 2.0f, -1.0f,
-        -1.0f, 2.0f, -1.0f,
-
-        // Bottom face
-        -1.0f, 0.0f, -1.0f,
-         1.0f, 0.0f, -1.0f,
-         1.0f, 0.0f,  1.0f,
-        -1.0f, 0.0f,  1.0f,
-    };
+    void initialize(glm::vec3 position, glm::vec3 scale, int facadeLayer) {
+        this->position = position;
+        this->scale    = scale;
+        this->facadeLayer = facadeLayer;
+    }
 
-    // Neutral color
-    GLfloat color_buffer_data[72] = {
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,
-        0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f,  0.5f, 0.5f, 0.5f
-    };
+    glm::mat4 modelMatrix() const {
+        return glm::scale(glm::translate(glm::mat4(1.0f), position), scale);
+    }
 
-    // UVs
-    GLfloat uv_buffer_data[48] = {
-        // Front
-        0.0f, 1.0f,  1.0f, 1.0f,  1.0f, 0.0f,  0.0f, 0.0f,
-        // Back
-        0.0f, 1.0f,  1.0f, 1.0f,  1.0f, 0.0f,  0.0f, 0.0f,
-        // Left
-        0.0f, 1.0f,  1.0f, 1.0f,  1.0f, 0.0f,  0.0f, 0.0f,
-        // Right
-        0.0f, 1.0f,  1.0f, 1.0f,  1.0f, 0.0f,  0.0f, 0.0f,
-        // Top (not used much)
-        0.0f, 0.0f,  0.0f, 0.0f,  0.0f, 0.0f,  0.0f, 0.0f,
-        // Bottom (not used much)
-        0.0f, 0.0f,  0.0f, 0.0f,  0.0f, 0.0f,  0.0f, 0.0f,
-    };
+    // The box spans x,z in [-1, 1] and y in [0, 2] before scaling
+    glm::vec3 boundsMin() const { return position + scale * glm::vec3(-1.0f, 0.0f, -1.0f); }
+    glm::vec3 boundsMax() const { return position + scale * glm::vec3(1.0f, 2.0f, 1.0f); }
 
-    // (Point 3) Normals per face (24 vertices)
-    // Front:  (0,0,1), Back: (0,0,-1), Left: (-1,0,0), Right: (1,0,0), Top: (0,1,0), Bottom: (0,-1,0)
-    GLfloat normal_buffer_data[72] = {
-        // Front
-         0.f, 0.f,  1.f,   0.f, 0.f,  1.f,   0.f, 0.f,  1.f,   0.f, 0.f,  1.f,
-        // Back
-         0.f, 0.f, -1.f,   0.f, 0.f, -1.f,   0.f, 0.f, -1.f,   0.f, 0.f, -1.f,
-        // Left
-        -1.f, 0.f,  0.f,  -1.f, 0.f,  0.f,  -1.f, 0.f,  0.f,  -1.f, 0.f,  0.f,
-        // Right
-         1.f, 0.f,  0.f,   1.f, 0.f,  0.f,   1.f, 0.f,  0.f,   1.f, 0.f,  0.f,
-        // Top
-         0.f, 1.f,  0.f,   0.f, 1.f,  0.f,   0.f, 1.f,  0.f,   0.f, 1.f,  0.f,
-        // Bottom
-         0.f,-1.f,  0.f,   0.f,-1.f,  0.f,   0.f,-1.f,  0.f,   0.f,-1.f,  0.f,
-    };
+    // State every per-building draw shares, facades included: bound once per run of draws
+    static void bindShared(GLuint shadowMapTex) {
+        glUseProgram(buildingProgram);
+        glBindVertexArray(boxMesh.vertexArrayID);
 
-    GLuint index_buffer_data[36] = {
-        0, 1, 2,   0, 2, 3,        // Front
-        4, 5, 6,   4, 6, 7,        // Back
-        8, 9, 10,  8, 10, 11,      // Left
-        12, 13, 14, 12, 14, 15,    // Right
-        16, 17, 18, 16, 18, 19,    // Top
-        20, 21, 22, 20, 22, 23     // Bottom
-    };
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, facadeMaterials.arrayID);
 
-    GLuint vertexArrayID = 0;
-    GLuint vertexBufferID = 0;
-    GLuint colorBufferID  = 0;
-    GLuint uvBufferID     = 0;
-    GLuint normalBufferID = 0;
-    GLuint indexBufferID  = 0;
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTex);
+    }
 
-    GLuint programID = 0;
-    GLuint mvpMatrixID = 0;
-    GLuint textureSamplerID = 0;
-    GLuint textureID = 0;
-    GLuint modelMatrixID;
-    GLuint lightPosID;
-    GLuint lightIntID;
-    GLuint lightSpaceMatrixID;
-    GLuint shadowMapID;
+    // Camera, light and fog come from the FrameUniforms block; only the model matrix and
+    // facade layer are per draw. Expects bindShared().
+    void draw() const {
+        glm::mat4 model = modelMatrix();
+        glUniformMatrix4fv(buildingModelID, 1, GL_FALSE, &model[0][0]);
+        glUniform1f(buildingLayerID, float(facadeLayer));
+        glDrawElements(GL_TRIANGLES, BoxMesh::INDEX_COUNT, GL_UNSIGNED_INT, (void*)0);
+    }
 
-    void initialize(glm::vec3 position, glm::vec3 scale, const char* texture_path) {
-        this->position = position;
-        this->scale    = scale;
+    void renderDepth(GLuint depthProgram, GLuint depthModelID) const {
+        glUseProgram(depthProgram);
+        glBindVertexArray(boxMesh.vertexArrayID);
 
-        glGenVertexArrays(1, &vertexArrayID);
-        glBindVertexArray(vertexArrayID);
+        glm::mat4 model = modelMatrix();
+        glUniformMatrix4fv(depthModelID, 1, GL_FALSE, &model[0][0]);
 
-        glGenBuffers(1, &vertexBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+        glDrawElements(GL_TRIANGLES, BoxMesh::INDEX_COUNT, GL_UNSIGNED_INT, (void*)0);
+        glBindVertexArray(0);
+    }
+};
 
-        glGenBuffers(1, &colorBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
+// ============================================================
+// Instanced building pool: one shared box, one draw per pass
+// ============================================================
+// One record of the instance pool texture buffer (5 RGBA32F texels), read by both passes
+struct BuildingInstance {
+    glm::mat4 model;
+    glm::vec4 params;   // x = facade layer
+};
 
-        // Tile V coordinate
-        for (int i = 0; i < 24; ++i) uv_buffer_data[2 * i + 1] *= 5;
+// Each pass draws from its own visible-index buffer + VAO. Shadow cascade i uses pass
+// PASS_SHADOW + i. The camera culls into PASS_CAMERA, then assignLods() moves the
+// farther entries to the cheaper tiers.
+enum BatchPass {
+    PASS_SHADOW = 0,
+    PASS_CAMERA = PASS_SHADOW + MAX_SHADOW_CASCADES,   // near (and the ground): full lit shader
+    PASS_CAMERA_MID,                                    // lit shader, one shadow compare instead of PCF
+    PASS_IMPOSTOR,                                      // camera-facing quads from impostorAtlas
+    PASS_COUNT
+};
 
-        glGenBuffers(1, &uvBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
+struct BuildingBatch {
+    GLuint vertexArrayID[PASS_COUNT] = {};
+    GLuint visibleBufferID[PASS_COUNT] = {};
 
-        // (Point 3) Normal buffer
-        glGenBuffers(1, &normalBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
+    // Every pool entry lives on the GPU; only changed ranges are re-uploaded
+    GLuint instancePoolBufferID = 0;
+    GLuint instancePoolTextureID = 0;
 
-        glGenBuffers(1, &indexBufferID);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
-
-        programID = LoadShadersFromFile("lab2/lit_box.vert", "lab2/lit_box.frag");
-        mvpMatrixID = glGetUniformLocation(programID, "MVP");
-        modelMatrixID = glGetUniformLocation(programID, "Model");
-        textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-        lightPosID = glGetUniformLocation(programID, "lightPosition");
-        lightIntID = glGetUniformLocation(programID, "lightIntensity");
-        lightSpaceMatrixID = glGetUniformLocation(programID, "lightSpaceMatrix");
-        shadowMapID = glGetUniformLocation(programID, "shadowMap");
-        textureID = LoadTextureTileBox(texture_path);
+    GLuint programID = 0;
+    GLuint midProgramID = 0;
+    GLuint impostorProgramID = 0;
+    GLuint impostorRowsID = 0;
+    GLuint depthProgramID = 0;
+    GLuint depthCascadeID = 0;
+    GLuint prepassProgramID = 0;
+
+    // Index i is buildings[i]; the ground is last
+    std::vector<BuildingInstance> instances;
+    std::vector<unsigned char> live;
+    int liveCount = 0;
+    AabbSoA bounds;
+
+    std::vector<int> visible[PASS_COUNT];
+    CullStats stats[PASS_COUNT];
+    CullScratch cullScratch;
+
+    // Camera tier (a BatchPass) of each entry in visible[PASS_CAMERA], from assignLods()
+    std::vector<unsigned char> cameraPass;
+
+    static BuildingInstance makeInstance(const Building& b) {
+        BuildingInstance inst;
+        inst.model = b.modelMatrix();
+        inst.params = glm::vec4(float(b.facadeLayer), 0.0f, 0.0f, 0.0f);
+        return inst;
+    }
+
+    void initialize(int poolSize) {
+        // Same shared box the per-building path draws; each pass adds its own instance stream
+        for (int pass = 0; pass < PASS_COUNT; ++pass) {
+            glGenVertexArrays(1, &vertexArrayID[pass]);
+            glBindVertexArray(vertexArrayID[pass]);
+            boxMesh.bindAttributes();
 
+            // Visible pool indices, refilled every frame; the shader fetches the instance itself
+            glGenBuffers(1, &visibleBufferID[pass]);
+            VertexFormat(sizeof(int), 1).addInteger(4, 1, GL_INT, 0).apply(visibleBufferID[pass]);
+        }
         glBindVertexArray(0);
-    }
 
-    void render(const glm::mat4& vp, const glm::mat4& lightSpaceMatrix, GLuint depthMapTex) {
+        instances.assign(poolSize, BuildingInstance());
+        live.assign(poolSize, 0);
+        cameraPass.assign(poolSize, PASS_CAMERA);
+        liveCount = 0;
+        bounds.clear();
+        bounds.reserve(poolSize);
+        for (int i = 0; i < poolSize; ++i) bounds.push(glm::vec3(0.0f), glm::vec3(0.0f));
+
+        glGenBuffers(1, &instancePoolBufferID);
+        glBindBuffer(GL_TEXTURE_BUFFER, instancePoolBufferID);
+        glBufferData(GL_TEXTURE_BUFFER, poolSize * sizeof(BuildingInstance), NULL, GL_DYNAMIC_DRAW);
+        glGenTextures(1, &instancePoolTextureID);
+        glBindTexture(GL_TEXTURE_BUFFER, instancePoolTextureID);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instancePoolBufferID);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        programID = LoadShadersFromFile("lab2/lit_box.vert", "lab2/lit_box.frag", "INSTANCED;" SHADOW_FILTER);
+        bindFrameUniforms(programID);
         glUseProgram(programID);
-        glUniform3fv(glGetUniformLocation(programID, "cameraPos"), 1, &eye_center[0]);
+        glUniform1i(glGetUniformLocation(programID, "textureSampler"), 0);
+        glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+        glUniform1i(glGetUniformLocation(programID, "instancePool"), 2);
+
+        // Mid tier: no PCF define, so FilterShadow() is a single bilinear compare
+        midProgramID = LoadShadersFromFile("lab2/lit_box.vert", "lab2/lit_box.frag", "INSTANCED");
+        bindFrameUniforms(midProgramID);
+        glUseProgram(midProgramID);
+        glUniform1i(glGetUniformLocation(midProgramID, "textureSampler"), 0);
+        glUniform1i(glGetUniformLocation(midProgramID, "shadowMap"), 1);
+        glUniform1i(glGetUniformLocation(midProgramID, "instancePool"), 2);
+
+        std::string impostorDefines = "IMPOSTOR_VIEWS=" + std::to_string(ImpostorAtlas::VIEWS);
+        impostorProgramID = LoadShadersFromFile("lab2/impostor.vert", "lab2/impostor.frag", impostorDefines.c_str());
+        bindFrameUniforms(impostorProgramID);
+        glUseProgram(impostorProgramID);
+        glUniform1i(glGetUniformLocation(impostorProgramID, "atlas"), 0);
+        glUniform1i(glGetUniformLocation(impostorProgramID, "instancePool"), 2);
+        impostorRowsID = glGetUniformLocation(impostorProgramID, "atlasRows");
+
+        depthProgramID = LoadShadersFromFile("lab2/shadow_depth.vert", "lab2/shadow_depth.frag", "INSTANCED");
+        bindFrameUniforms(depthProgramID);
+        glUseProgram(depthProgramID);
+        glUniform1i(glGetUniformLocation(depthProgramID, "instancePool"), 2);
+        depthCascadeID = glGetUniformLocation(depthProgramID, "cascade");
+
+        prepassProgramID = LoadShadersFromFile("lab2/shadow_depth.vert", "lab2/shadow_depth.frag", "INSTANCED;CAMERA_DEPTH");
+        bindFrameUniforms(prepassProgramID);
+        glUseProgram(prepassProgramID);
+        glUniform1i(glGetUniformLocation(prepassProgramID, "instancePool"), 2);
+    }
 
-        glUniform3f(glGetUniformLocation(programID, "fogColor"),
-                    0.08f, 0.10f, 0.14f);   // tweak if you want
+    // Writes one pool entry (CPU side); upload() makes it visible to the GPU
+    void setInstance(int i, const Building& b) {
+        if (!live[i]) liveCount++;
+        live[i] = 1;
+        instances[i] = makeInstance(b);
+        bounds.set(i, b.boundsMin(), b.boundsMax());
+    }
 
-        glUniform1f(glGetUniformLocation(programID, "fogDensity"),
-                    0.00001f);           // tweak if too strong/weak
+    // Frees a pool entry; callers also drop it from whatever feeds cull() candidates
+    void clearInstance(int i) {
+        if (live[i]) liveCount--;
+        live[i] = 0;
+    }
 
-        glBindVertexArray(vertexArrayID);
+    // Copies a contiguous range of pool entries (e.g. one chunk) to the GPU
+    void upload(int first, int count) {
+        glBindBuffer(GL_TEXTURE_BUFFER, instancePoolBufferID);
+        glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(BuildingInstance), count * sizeof(BuildingInstance), &instances[first]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
 
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, position);
-        model = glm::scale(model, scale);
-        glm::mat4 mvp = vp * model;
+    // Culls `candidates` against `viewProj` into visible[pass]; uploadVisible() sends it to the GPU
+    void cull(BatchPass pass, const glm::mat4& viewProj, const std::vector<int>& candidates) {
+        CullAabbs(Frustum::fromMatrix(viewProj), bounds, candidates, visible[pass], stats[pass], cullScratch);
+        // Live entries the grid query skipped count as culled too
+        stats[pass].culled = liveCount - stats[pass].drawn;
+    }
 
-        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-        glUniformMatrix4fv(modelMatrixID, 1, GL_FALSE, &model[0][0]);
-        glUniformMatrix4fv(lightSpaceMatrixID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+    // Tier of every entry of visible[PASS_CAMERA], by the distance from `eye` to its box. The
+    // ground (last entry) always gets the full shader. Off = everything in the full tier.
+    void assignLods(const glm::vec3& eye, bool enabled, float midDistance, float impostorDistance) {
+        const int groundIndex = int(instances.size()) - 1;
+        for (int i : visible[PASS_CAMERA]) {
+            BatchPass pass = PASS_CAMERA;
+            if (enabled && i != groundIndex) {
+                glm::vec3 center(bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i]);
+                glm::vec3 extent(bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i]);
+                float distance = glm::length(glm::max(glm::abs(eye - center) - extent, glm::vec3(0.0f)));
+                if (distance >= impostorDistance) pass = PASS_IMPOSTOR;
+                else if (distance >= midDistance) pass = PASS_CAMERA_MID;
+            }
+            cameraPass[i] = (unsigned char)pass;
+        }
+    }
 
+    // Program a camera tier is shaded with (its render queue state)
+    GLuint cameraProgram(BatchPass pass) const {
+        if (pass == PASS_IMPOSTOR) return impostorProgramID;
+        return pass == PASS_CAMERA_MID ? midProgramID : programID;
+    }
 
-        glm::vec3 lightPos(200.0f, 600.0f, 200.0f);
-        glm::vec3 lightIntensity(50.0f, 50.0f, 50.0f);
-        glUniform3f(lightPosID, lightPos.x, lightPos.y, lightPos.z);
-        glUniform3f(lightIntID, lightIntensity.x, lightIntensity.y, lightIntensity.z);
+    // Instances are drawn in the order of visible[pass], so reorder it before this
+    void uploadVisible(BatchPass pass) {
+        // Orphan and refill so the driver does not wait on last frame's draw
+        glBindBuffer(GL_ARRAY_BUFFER, visibleBufferID[pass]);
+        glBufferData(GL_ARRAY_BUFFER, visible[pass].size() * sizeof(int), NULL, GL_STREAM_DRAW);
+        if (!visible[pass].empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, visible[pass].size() * sizeof(int), &visible[pass][0]);
+        }
+    }
 
-        // Position
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    void bindInstancePool() {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, instancePoolTextureID);
+    }
 
-        // Color
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    // Visible casters of one cascade, ground included, in a single draw into the bound layer
+    void renderDepth(int cascade) {
+        const int pass = PASS_SHADOW + cascade;
+        if (visible[pass].empty()) return;
+        glUseProgram(depthProgramID);
+        glUniform1i(depthCascadeID, cascade);
+        bindInstancePool();
 
-        // UV
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+        glBindVertexArray(vertexArrayID[pass]);
+        glDrawElementsInstanced(GL_TRIANGLES, BoxMesh::INDEX_COUNT, GL_UNSIGNED_INT, (void*)0, GLsizei(visible[pass].size()));
+        glBindVertexArray(0);
+    }
 
-        // Normals attribute 
-        glEnableVertexAttribArray(3);
-        glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    // Camera depth only for the box tiers, from the same visible lists render() draws next
+    void renderPrepass() {
+        glUseProgram(prepassProgramID);
+        bindInstancePool();
 
-        // Indices
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+        for (int pass = PASS_CAMERA; pass <= PASS_CAMERA_MID; ++pass) {
+            if (visible[pass].empty()) continue;
+            glBindVertexArray(vertexArrayID[pass]);
+            glDrawElementsInstanced(GL_TRIANGLES, BoxMesh::INDEX_COUNT, GL_UNSIGNED_INT, (void*)0, GLsizei(visible[pass].size()));
+        }
+        glBindVertexArray(0);
+    }
 
-        // Texture
+    // Near and mid tiers, one draw each
+    void render(GLuint shadowMapTex) {
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glUniform1i(textureSamplerID, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, facadeMaterials.arrayID);
 
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, depthMapTex);
-        glUniform1i(shadowMapID, 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMapTex);
+
+        bindInstancePool();
+
+        for (int pass = PASS_CAMERA; pass <= PASS_CAMERA_MID; ++pass) {
+            if (visible[pass].empty()) continue;
+            glUseProgram(cameraProgram(BatchPass(pass)));
+            glBindVertexArray(vertexArrayID[pass]);
+            glDrawElementsInstanced(GL_TRIANGLES, BoxMesh::INDEX_COUNT, GL_UNSIGNED_INT, (void*)0, GLsizei(visible[pass].size()));
+        }
+        glBindVertexArray(0);
+    }
+
+    // Far tier: one 6-vertex strip (a quad per visible face) per instance, corners from
+    // gl_VertexID. Not in the pre-pass, so it depth-tests normally and alpha-tests the atlas.
+    void renderImpostors() {
+        if (visible[PASS_IMPOSTOR].empty()) return;
+        glUseProgram(impostorProgramID);
+        glUniform1f(impostorRowsID, float(impostorAtlas.rows));
 
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, impostorAtlas.textureID);
 
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(2);
-        glDisableVertexAttribArray(3);
+        bindInstancePool();
 
+        glBindVertexArray(vertexArrayID[PASS_IMPOSTOR]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 6, GLsizei(visible[PASS_IMPOSTOR].size()));
         glBindVertexArray(0);
     }
 
-    void renderDepth(GLuint depthProgram, GLuint depthModelID) {
-        glUseProgram(depthProgram);
-        glBindVertexArray(vertexArrayID);
+    void cleanup() {
+        glDeleteBuffers(PASS_COUNT, visibleBufferID);
+        glDeleteBuffers(1, &instancePoolBufferID);
+        glDeleteTextures(1, &instancePoolTextureID);
+        glDeleteVertexArrays(PASS_COUNT, vertexArrayID);
+        ReleaseShaderProgram(programID);
+        ReleaseShaderProgram(midProgramID);
+        ReleaseShaderProgram(impostorProgramID);
+        ReleaseShaderProgram(depthProgramID);
+        ReleaseShaderProgram(prepassProgramID);
+    }
+};
 
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, position);
-        model = glm::scale(model, scale);
+// ============================================================
+// Sample counter (overdraw statistics)
+// ============================================================
+// GL_SAMPLES_PASSED around one pass. Results are read a few frames late, and only once
+// available, so the counter never stalls the pipeline.
+struct SampleCounter {
+    static const int LATENCY = 3;
 
-        glUniformMatrix4fv(depthModelID, 1, GL_FALSE, &model[0][0]);
+    GLuint queryIDs[LATENCY] = {};
+    int frame = 0;
+    GLuint64 samples = 0;       // latest result that came back
 
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    void initialize() {
+        glGenQueries(LATENCY, queryIDs);
+    }
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
+    void begin() {
+        glBeginQuery(GL_SAMPLES_PASSED, queryIDs[frame % LATENCY]);
+    }
 
-        glDisableVertexAttribArray(0);
-        glBindVertexArray(0);
+    void end() {
+        glEndQuery(GL_SAMPLES_PASSED);
+        frame++;
+
+        // The oldest query is the one the next begin() reuses
+        if (frame >= LATENCY) {
+            GLuint available = 0;
+            glGetQueryObjectuiv(queryIDs[frame % LATENCY], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) glGetQueryObjectui64v(queryIDs[frame % LATENCY], GL_QUERY_RESULT, &samples);
+        }
     }
 
     void cleanup() {
-        glDeleteBuffers(1, &vertexBufferID);
-        glDeleteBuffers(1, &colorBufferID);
-        glDeleteBuffers(1, &uvBufferID);
-        glDeleteBuffers(1, &normalBufferID);
-        glDeleteBuffers(1, &indexBufferID);
-        glDeleteVertexArrays(1, &vertexArrayID);
-        glDeleteProgram(programID);
-        glDeleteTextures(1, &textureID);
+        glDeleteQueries(LATENCY, queryIDs);
     }
 };
 
 // ============================================================
 // Skybox structure
 // ============================================================
+// Sky as a cube map, drawn as one full-screen triangle at the far plane
 struct Skybox {
-    GLfloat vertex_buffer_data[72] = {
-        // Front (+Z)
-        -1.0f,-1.0f, 1.0f,  1.0f,-1.0f, 1.0f,  1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f,
-        // Back (-Z)
-         1.0f,-1.0f,-1.0f, -1.0f,-1.0f,-1.0f, -1.0f, 1.0f,-1.0f,  1.0f, 1.0f,-1.0f,
-        // Left (-X)
-        -1.0f,-1.0f,-1.0f, -1.0f,-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f,-1.0f,
-        // Right (+X)
-         1.0f,-1.0f, 1.0f,  1.0f,-1.0f,-1.0f,  1.0f, 1.0f,-1.0f,  1.0f, 1.0f, 1.0f,
-        // Top (+Y)
-        -1.0f, 1.0f, 1.0f,  1.0f, 1.0f, 1.0f,  1.0f, 1.0f,-1.0f, -1.0f, 1.0f,-1.0f,
-        // Bottom (-Y)
-        -1.0f,-1.0f,-1.0f,  1.0f,-1.0f,-1.0f,  1.0f,-1.0f, 1.0f, -1.0f,-1.0f, 1.0f,
-    };
-
-    GLuint index_buffer_data[36] = {
-        0,1,2, 0,2,3,  4,5,6, 4,6,7,  8,9,10, 8,10,11,
-        12,13,14, 12,14,15,  16,17,18, 16,18,19,  20,21,22, 20,22,23
-    };
-
-    // UVs mapped for your skybox layout
-    GLfloat uv_buffer_data[48] = {
-        // Front (+Z)
-        0.25f, 0.6667f,  0.50f, 0.6667f,  0.50f, 0.3333f,  0.25f, 0.3333f,
-        // Back (-Z)
-        0.75f, 0.6667f,  1.00f, 0.6667f,  1.00f, 0.3333f,  0.75f, 0.3333f,
-        // Left (-X)
-        0.00f, 0.6667f,  0.25f, 0.6667f,  0.25f, 0.3333f,  0.00f, 0.3333f,
-        // Right (+X)
-        0.50f, 0.6667f,  0.75f, 0.6667f,  0.75f, 0.3333f,  0.50f, 0.3333f,
-        // Top (+Y)
-        0.25f, 1.0000f,  0.50f, 1.0000f,  0.50f, 0.6667f,  0.25f, 0.6667f,
-        // Bottom (-Y)
-        0.25f, 0.3333f,  0.50f, 0.3333f,  0.50f, 0.0000f,  0.25f, 0.0000f
-    };
-
-    GLuint vertexArrayID = 0;
-    GLuint vertexBufferID = 0;
-    GLuint uvBufferID = 0;
-    GLuint indexBufferID = 0;
+    GLuint vertexArrayID = 0;       // empty; the triangle comes from gl_VertexID
 
     GLuint programID = 0;
-    GLuint viewMatrixID = 0;
-    GLuint projMatrixID = 0;
-    GLuint textureSamplerID = 0;
+    GLuint invViewProjID = 0;
     GLuint textureID = 0;
 
     void initialize(const char* sky_texture_path) {
         glGenVertexArrays(1, &vertexArrayID);
-        glBindVertexArray(vertexArrayID);
-
-        glGenBuffers(1, &vertexBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
-
-        glGenBuffers(1, &uvBufferID);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
 
-        glGenBuffers(1, &indexBufferID);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+        programID = LoadShadersFromFile("lab2/sky_cube.vert", "lab2/sky_cube.frag");
+        invViewProjID = glGetUniformLocation(programID, "invViewProj");
 
-        programID = LoadShadersFromFile("lab2/skybox.vert", "lab2/skybox.frag");
-        viewMatrixID = glGetUniformLocation(programID, "view");
-        projMatrixID = glGetUniformLocation(programID, "projection");
-        textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-
-        textureID = LoadSkyboxTexture(sky_texture_path);
+        glUseProgram(programID);
+        glUniform1i(glGetUniformLocation(programID, "skybox"), 0);
 
-        glBindVertexArray(0);
+        // The cross image is split into faces once and then dropped from the cache
+        const DecodedImage* cross = textureCache.image(sky_texture_path, true);
+        if (cross) textureID = CreateCrossCubemap(*cross);
+        textureCache.release(sky_texture_path, true);
     }
 
     void render(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix) {
@@ -465,55 +619,31 @@ struct Skybox {
 
         glUseProgram(programID);
 
-        // Remove translation from view so skybox stays centered
+        // Remove translation from view so rays start at the camera
         glm::mat4 viewNoTranslate = glm::mat4(glm::mat3(viewMatrix));
-
-        glUniformMatrix4fv(viewMatrixID, 1, GL_FALSE, &viewNoTranslate[0][0]);
-        glUniformMatrix4fv(projMatrixID, 1, GL_FALSE, &projectionMatrix[0][0]);
-
-        glBindVertexArray(vertexArrayID);
-
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+        glm::mat4 invViewProj = glm::inverse(projectionMatrix * viewNoTranslate);
+        glUniformMatrix4fv(invViewProjID, 1, GL_FALSE, &invViewProj[0][0]);
 
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glUniform1i(textureSamplerID, 0);
-
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, (void*)0);
-
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(2);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
+        glBindVertexArray(vertexArrayID);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
         glBindVertexArray(0);
 
         glDepthFunc(GL_LESS);
     }
 
     void cleanup() {
-        glDeleteBuffers(1, &vertexBufferID);
-        glDeleteBuffers(1, &uvBufferID);
-        glDeleteBuffers(1, &indexBufferID);
-        glDeleteVertexArrays(1, &vertexArrayID);
-        glDeleteProgram(programID);
         glDeleteTextures(1, &textureID);
+        glDeleteVertexArrays(1, &vertexArrayID);
+        ReleaseShaderProgram(programID);
     }
 };
 
 // ============================================================
-// Helpers (random + camera)
+// Helpers (camera + city streaming)
 // ============================================================
-static float rand01() {
-    return float(rand()) / float(RAND_MAX);
-}
-
 static void update_camera_walk() {
     // Simple "walk + turn" camera.
     glm::vec3 forward(cos(yaw), 0.0f, sin(yaw));
@@ -521,6 +651,60 @@ static void update_camera_walk() {
     lookat = eye_center + forward * 250.0f;
 }
 
+// Grid items that may intersect `viewProj`: the XZ footprint of its corners, limited to
+// `reach` around the player (nothing lives further out) and padded by `margin` for box size
+static void gatherCandidates(const SpatialGrid& grid, const glm::mat4& viewProj, float reach, float margin,
+                             int groundIndex, std::vector<int>& out) {
+    glm::vec3 corners[8];
+    Frustum::corners(viewProj, corners);
+
+    glm::vec2 lo(corners[0].x, corners[0].z), hi = lo;
+    for (int i = 1; i < 8; ++i) {
+        lo = glm::min(lo, glm::vec2(corners[i].x, corners[i].z));
+        hi = glm::max(hi, glm::vec2(corners[i].x, corners[i].z));
+    }
+    glm::vec2 center(playerPos.x, playerPos.z);
+    lo = glm::max(lo, center - reach) - margin;
+    hi = glm::min(hi, center + reach) + margin;
+
+    out.clear();
+    if (lo.x <= hi.x && lo.y <= hi.y) grid.queryRect(lo.x, lo.y, hi.x, hi.y, out);
+    out.push_back(groundIndex);  // the ground is not in the grid
+}
+
+// Mirrors streamed chunks into the building pool, the grid, the GPU instance pool and
+// the shadow cache (tiles under a building that came or went are drawn again)
+static void applyChunkChanges(const CityStreamer& city, const std::vector<int>& loaded, const std::vector<int>& unloaded,
+                              const std::vector<int>& facadeLayers, std::vector<Building>& buildings,
+                              BuildingBatch& batch, SpatialGrid& grid) {
+    const int perChunk = city.params.maxBuildingsPerChunk();
+
+    for (int s : unloaded) {
+        for (int i = s * perChunk; i < (s + 1) * perChunk; ++i) {
+            if (batch.live[i]) shadows.invalidate(buildings[i].boundsMin(), buildings[i].boundsMax());
+            grid.remove(i);
+            batch.clearInstance(i);
+        }
+    }
+
+    for (int s : loaded) {
+        const std::vector<BuildingDesc>& descs = city.slot(s).buildings;
+        const int first = s * perChunk;
+        for (size_t j = 0; j < descs.size(); ++j) {
+            int i = first + int(j);
+            Building& b = buildings[i];
+            b.position = descs[j].position;
+            b.scale = descs[j].scale;
+            b.facadeLayer = facadeLayers[descs[j].facadeLayer];
+
+            grid.place(i, b.position.x, b.position.z);
+            batch.setInstance(i, b);
+            shadows.invalidate(b.boundsMin(), b.boundsMax());
+        }
+        if (!descs.empty()) batch.upload(first, int(descs.size()));
+    }
+}
+
 int main() {
     if (!glfwInit()) {
         std::cout << "Failed to init GLFW\n";
@@ -550,70 +734,119 @@ int main() {
     glDepthFunc(GL_LESS);
 
     // Shadow map setup
-    initShadowMap();
+    shadows.initialize(SHADOW_CASCADES, SHADOW_RESOLUTION);
+    initFrameUniforms();
     depthProgram = LoadShadersFromFile("lab2/shadow_depth.vert", "lab2/shadow_depth.frag");
-    depthLightSpaceID = glGetUniformLocation(depthProgram, "lightSpaceMatrix");
     depthModelID = glGetUniformLocation(depthProgram, "Model");
+    depthCascadeID = glGetUniformLocation(depthProgram, "cascade");
+    bindFrameUniforms(depthProgram);
+
+    prepassProgram = LoadShadersFromFile("lab2/shadow_depth.vert", "lab2/shadow_depth.frag", "CAMERA_DEPTH");
+    prepassModelID = glGetUniformLocation(prepassProgram, "Model");
+    bindFrameUniforms(prepassProgram);
+
+    buildingProgram = LoadShadersFromFile("lab2/lit_box.vert", "lab2/lit_box.frag", SHADOW_FILTER);
+    buildingModelID = glGetUniformLocation(buildingProgram, "Model");
+    buildingLayerID = glGetUniformLocation(buildingProgram, "layer");
+    bindFrameUniforms(buildingProgram);
+
+    // Samplers never change units, so set them once here instead of per draw
+    glUseProgram(buildingProgram);
+    glUniform1i(glGetUniformLocation(buildingProgram, "textureSampler"), 0);
+    glUniform1i(glGetUniformLocation(buildingProgram, "shadowMap"), 1);
 
-    // Random seed (for procedural placement)
-    srand(12345);
+    boxMesh.initialize();
 
     // Initial camera/player state
     playerPos = glm::vec3(0.0f, 0.0f, 0.0f);
     yaw = 0.0f;
     update_camera_walk();
 
-    // --- Create skybox ---
-    Skybox sky;
-    sky.initialize("lab2/skyNeb.png");
-
-    // --- Create buildings ---
-    std::vector<Building> buildings;
-
-    // Example layout
+    // Building facades (picked per building by the city generator) and the ground
     const char* facades[] = {
         "lab2/skin.png",
         "lab2/skin2.png",
         "lab2/skin3.png",
         "lab2/skin4.png"
     };
+    const char* groundTexture = "lab2/facade0.jpg";
 
-    // "Minecraft-ish" infinite illusion: keep a fixed pool of buildings
-    // and recycle them around the player as they move.
-    const int BUILDING_COUNT = 220;
-    const float SPAWN_RADIUS = 900.0f;   // initial scatter radius
-    const float BASE_SIZE = 16.0f;
+    // Decode every unique image in parallel while the GL objects are being set up
+    textureCache.start();
+    textureCache.prefetch("lab2/skyNeb.png", true);
+    for (const char* f : facades) textureCache.prefetch(f);
+    textureCache.prefetch(groundTexture);
 
-    buildings.reserve(BUILDING_COUNT);
-    for (int i = 0; i < BUILDING_COUNT; ++i) {
-        Building b;
-        float angle = rand01() * 2.0f * float(M_PI);
-        float r = rand01() * SPAWN_RADIUS;
-        float x = cos(angle) * r;
-        float z = sin(angle) * r;
+    // Starts small and grows as facades are added
+    facadeMaterials.initialize(textureCache, FACADE_SIZE, FACADE_SIZE, 4);
+    std::vector<int> facadeLayers;
+    for (const char* f : facades) facadeLayers.push_back(facadeMaterials.add(f));
+    const int groundLayer = facadeMaterials.add(groundTexture);
 
-        float h = 35.0f + rand01() * 120.0f;
-        int texIdx = int(rand01() * 4.0f) % 4;
+    // Far LOD tier: the box seen from every baked direction, once per facade
+    impostorAtlas.bake(boxMesh.vertexArrayID, BoxMesh::INDEX_COUNT, facadeMaterials.arrayID, facadeMaterials.count);
 
-        b.initialize(glm::vec3(x, 0.0f, z),
-                     glm::vec3(BASE_SIZE, h, BASE_SIZE),
-                     facades[texIdx]);
-        buildings.push_back(b);
-    }
+    // --- Create skybox ---
+    Skybox sky;
+    sky.initialize("lab2/skyNeb.png");
+
+    // --- Create buildings ---
+    // The city is cut into chunks whose layout comes from a hash of the chunk coordinates,
+    // so it is identical on every run. Each resident chunk owns a fixed range of the pool.
+    CityStreamer city;
+    city.params.facadeCount = int(facadeLayers.size());
+    city.start(2);
+
+    const int POOL_SIZE = city.slotCount() * city.params.maxBuildingsPerChunk();
+    const int GROUND_INDEX = POOL_SIZE;
+
+    // Plain transform + material records; all of them draw the shared boxMesh
+    std::vector<Building> buildings(POOL_SIZE);
 
     // Ground plane
     Building ground;
     ground.initialize(glm::vec3(0.0f, 0.0f, 0.0f),
                       glm::vec3(4000.0f, 2.0f, 4000.0f),
-                      "lab2/facade0.jpg");
+                      groundLayer);
+
+    // Whole pool + ground in one instanced draw
+    BuildingBatch batch;
+    batch.initialize(POOL_SIZE + 1);
+    batch.setInstance(GROUND_INDEX, ground);
+    batch.upload(GROUND_INDEX, 1);
+
+    // Buildings bucketed by cell, so culling only tests the cells a frustum covers
+    const float CELL_SIZE = 128.0f;
+    SpatialGrid grid;
+    grid.initialize(CELL_SIZE, POOL_SIZE);
+
+    std::vector<int> loadedSlots, unloadedSlots;
+    std::vector<int> candidates;
+    // Resident buildings are at most unloadRadius plus a chunk diagonal from the player
+    const float gridReach = city.unloadRadius + 1.5f * city.params.chunkSize;
+
+    // Start with the surrounding city in place rather than streaming it in on screen
+    city.waitForPending(playerPos, loadedSlots, unloadedSlots);
+    applyChunkChanges(city, loadedSlots, unloadedSlots, facadeLayers, buildings, batch, grid);
+
+    std::cout << "Texture cache: " << textureCache.misses << " decodes, "
+              << textureCache.hits << " hits" << std::endl;
 
     double lastTime = glfwGetTime();
+    float statsTime = 0.0f;
+    int frames = 0;
+    long long shadowTexels = 0;     // re-rendered shadow texels since the last title update
+    int shadowCasters = 0;
+    std::vector<ShadowRegion> shadowRegions;
 
-    // Infinite illusion parameters
-    const float ACTIVE_RADIUS = 900.0f;   // if a building is outside this radius, recycle it
-    const float AHEAD_MIN = 700.0f;       // how far ahead to respawn recycled buildings
-    const float AHEAD_RAND = 500.0f;
-    const float SIDE_RANGE = 800.0f;
+    // Fragments the lit pass shades, for overdraw = samples / screen pixels
+    RenderQueue renderQueue;
+    renderQueue.reserve(POOL_SIZE + 2);
+
+    SampleCounter litSamples;
+    litSamples.initialize();
+    occlusion.initialize();
+    double litOverdraw = 0.0;
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
@@ -644,67 +877,210 @@ int main() {
         update_camera_walk();
 
         // ------------------------------------------------------------
-        // Recycle buildings to create an "infinite" foreground
+        // Stream city chunks in/out around the player (generated off-thread)
         // ------------------------------------------------------------
-        for (auto &b : buildings) {
-            glm::vec2 d(b.position.x - playerPos.x, b.position.z - playerPos.z);
-            if (glm::length(d) > ACTIVE_RADIUS) {
-                float ahead = AHEAD_MIN + rand01() * AHEAD_RAND;
-                float side = (rand01() * 2.0f - 1.0f) * SIDE_RANGE;
-                b.position = playerPos + forward * ahead + right * side;
-
-                // Change the height a bit to avoid repeating patterns
-                b.scale.y = 35.0f + rand01() * 120.0f;
-            }
-        }
-        // ---------- PASS A: render depth map ----------
-        glm::vec3 lightPos(200.0f, 600.0f, 200.0f);
-        glm::vec3 lightTarget = playerPos;
+        loadedSlots.clear();
+        unloadedSlots.clear();
+        city.update(playerPos, loadedSlots, unloadedSlots);
+        applyChunkChanges(city, loadedSlots, unloadedSlots, facadeLayers, buildings, batch, grid);
 
-        glm::mat4 lightView = glm::lookAt(lightPos, lightTarget, glm::vec3(0, 1, 0));
-        float orthoSize = 1200.0f; // Change how much shadow in the scene. CHANGE IF WANNA SEE DIFFERENCE
-        glm::mat4 lightProj = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, 1.0f, 2000.0f);
-        glm::mat4 lightSpaceMatrix = lightProj * lightView;
+        // The light keeps a fixed offset from the player, so its direction never changes
+        // (normalised from the offset itself, so rounding never nudges it and flushes the shadow cache)
+        const glm::vec3 lightOffset(200.0f, 600.0f, 200.0f);
+        glm::vec3 lightPos = playerPos + lightOffset;
+        glm::vec3 toLight = glm::normalize(lightOffset);
 
-        glViewport(0, 0, SHADOW_W, SHADOW_H);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
 
-        glUseProgram(depthProgram);
-        glUniformMatrix4fv(depthLightSpaceID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+        // Camera matrices
+        const float fovY = glm::radians(45.0f);
+        const float aspect = (float)width / (float)height;
+        const float nearPlane = 0.1f;
+        const float farPlane = 2000.0f;
+        glm::mat4 viewMatrix = glm::lookAt(eye_center, lookat, up);
+        glm::mat4 projectionMatrix = glm::perspective(fovY, aspect, nearPlane, farPlane);
+        glm::mat4 vp = projectionMatrix * viewMatrix;
 
-        for (auto& b : buildings) {
-            b.renderDepth(depthProgram, depthModelID);
+        // One light matrix per slice of the camera frustum
+        shadows.update(viewMatrix, fovY, aspect, nearPlane, toLight);
+
+        // Everything both passes share goes up once, instead of once per draw
+        FrameUniforms frame;
+        frame.viewProj = vp;
+        frame.cameraPos = glm::vec4(eye_center, 1.0f);
+        frame.cameraForward = glm::vec4(glm::normalize(lookat - eye_center), 0.0f);
+        frame.lightPosition = glm::vec4(lightPos, 1.0f);
+        frame.lightDirection = glm::vec4(toLight, 0.0f);
+        frame.lightIntensity = glm::vec4(50.0f, 50.0f, 50.0f, 0.0f);
+        frame.fogColorDensity = glm::vec4(0.08f, 0.10f, 0.14f, 0.00001f);
+        for (int c = 0; c < MAX_SHADOW_CASCADES; ++c) {
+            frame.cascadeMatrices[c] = shadows.matrices[c];
+            frame.cascadeSplits[c] = shadows.splitFar[c];
+            frame.cascadeBias[c] = shadows.depthBias[c];
         }
-        ground.renderDepth(depthProgram, depthModelID);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        frame.shadowParams = glm::vec4(float(shadows.cascadeCount), 0.0f, 0.0f, 0.0f);
+        uploadFrameUniforms(frame);
+
+        gatherCandidates(grid, vp, gridReach, city.params.baseSize, GROUND_INDEX, candidates);
+        batch.cull(PASS_CAMERA, vp, candidates);
+
+        // Drop what was hidden in the last depth buffer that has come back from the GPU
+        occlusion.update();
+        if (useOcclusion) occlusion.cull(batch.bounds, batch.visible[PASS_CAMERA], batch.stats[PASS_CAMERA]);
+
+        // ---------- Camera render queue ----------
+        // One packet per visible building plus the sky; sorting by key puts the sky last
+        // and orders the buildings by state (LOD tier), then front to back
+        const glm::vec3 viewDir = glm::normalize(lookat - eye_center);
+        batch.assignLods(eye_center, useLod && useInstancing, lodMidDistance, lodImpostorDistance);
+        renderQueue.clear();
+        for (int i : batch.visible[PASS_CAMERA]) {
+            // The ground spans the whole view, so it only ever gets occluded: draw it last
+            float depth = 1.0f;
+            if (i != GROUND_INDEX) {
+                glm::vec3 center(batch.bounds.centerX[i], batch.bounds.centerY[i], batch.bounds.centerZ[i]);
+                depth = glm::dot(center - eye_center, viewDir) / farPlane;
+            }
+            const BatchPass tier = BatchPass(batch.cameraPass[i]);
+            const GLuint program = useInstancing ? batch.cameraProgram(tier) : buildingProgram;
+            const GLuint texture = (tier == PASS_IMPOSTOR) ? impostorAtlas.textureID : facadeMaterials.arrayID;
+            renderQueue.push(MakeSortKey(LAYER_OPAQUE, program, texture, depth), i);
+        }
+        renderQueue.push(MakeSortKey(LAYER_SKY, sky.programID, sky.textureID, 1.0f), -1);
+        renderQueue.sort();
+
+        // The batch draws each tier's visible list in one call, so the order lives in those lists
+        size_t opaqueEnd = 0;
+        while (opaqueEnd < renderQueue.size() && SortKeyLayer(renderQueue[opaqueEnd].key) == LAYER_OPAQUE) opaqueEnd++;
+        for (int pass = PASS_CAMERA; pass <= PASS_IMPOSTOR; ++pass) batch.visible[pass].clear();
+        for (size_t p = 0; p < opaqueEnd; ++p) {
+            int i = renderQueue[p].item;
+            batch.visible[batch.cameraPass[i]].push_back(i);
+        }
+        for (int pass = PASS_CAMERA; pass <= PASS_IMPOSTOR; ++pass) batch.uploadVisible(BatchPass(pass));
+
+        // ---------- PASS A: refresh the stale parts of the shadow cascades ----------
+        // Only tiles that scrolled in or whose casters changed; the rest is cached depth.
+        // Each region culls its casters against just its own light volume.
+        shadowRegions.clear();
+        shadows.collectRegions(shadowRegions);
+        for (const ShadowRegion& r : shadowRegions) {
+            const BatchPass pass = BatchPass(PASS_SHADOW + r.cascade);
+            gatherCandidates(grid, r.cullMatrix, gridReach, city.params.baseSize, GROUND_INDEX, candidates);
+            batch.cull(pass, r.cullMatrix, candidates);
+            batch.uploadVisible(pass);
+
+            shadows.beginRegion(r);
+            if (useInstancing) {
+                batch.renderDepth(r.cascade);
+            } else {
+                glUseProgram(depthProgram);
+                glUniform1i(depthCascadeID, r.cascade);
+                for (int i : batch.visible[pass]) {
+                    Building& b = (i < POOL_SIZE) ? buildings[i] : ground;
+                    b.renderDepth(depthProgram, depthModelID);
+                }
+            }
+            shadowTexels += r.width * r.height;
+            shadowCasters += int(batch.visible[pass].size());
+        }
+        shadows.end();
 
-        int width, height;
-        glfwGetFramebufferSize(window, &width, &height);
         glViewport(0, 0, width, height);
 
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Camera matrices
-        glm::mat4 viewMatrix = glm::lookAt(eye_center, lookat, up);
-        glm::mat4 projectionMatrix = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 2000.0f);
-        glm::mat4 vp = projectionMatrix * viewMatrix;
+        // ---------- PASS B: camera depth pre-pass (optional) ----------
+        // Position-only, so the expensive lit shader below only runs on the nearest surface
+        if (useDepthPrepass) {
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (useInstancing) {
+                batch.renderPrepass();
+            } else {
+                glUseProgram(prepassProgram);
+                for (size_t p = 0; p < opaqueEnd; ++p) {
+                    int i = renderQueue[p].item;
+                    Building& b = (i < POOL_SIZE) ? buildings[i] : ground;
+                    b.renderDepth(prepassProgram, prepassModelID);
+                }
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        }
 
-        // Render skybox first (as background)
-        sky.render(viewMatrix, projectionMatrix);
+        // Render buildings + ground; after a pre-pass depth is final, so test for equality only
+        if (useDepthPrepass) {
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+        litSamples.begin();
+        if (useInstancing) {
+            batch.render(shadows.depthArrayID);
+        } else {
+            Building::bindShared(shadows.depthArrayID);
+            for (size_t p = 0; p < opaqueEnd; ++p) {
+                int i = renderQueue[p].item;
+                ((i < POOL_SIZE) ? buildings[i] : ground).draw();
+            }
+            glBindVertexArray(0);
+        }
+        if (useDepthPrepass) {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        // Impostors were left out of the pre-pass, so they depth-test normally
+        if (useInstancing) batch.renderImpostors();
+        litSamples.end();
+        litOverdraw += double(litSamples.samples) / (double(width) * height);
+
+        // Sky layer: last, only where nothing else is (it sits at the far plane, GL_LEQUAL)
+        for (size_t p = opaqueEnd; p < renderQueue.size(); ++p) {
+            if (SortKeyLayer(renderQueue[p].key) == LAYER_SKY) sky.render(viewMatrix, projectionMatrix);
+        }
 
-        // Render buildings + ground
-        for (auto& b : buildings) b.render(vp, lightSpaceMatrix, depthMap);
-        ground.render(vp, lightSpaceMatrix, depthMap);
+        // This frame's depth becomes the occluders of a later one
+        occlusion.capture(width, height, vp);
+
+        // FPS + culling counters in the title
+        frames++;
+        statsTime += dt;
+        if (statsTime > 1.0f) {
+            const CullStats& cam = batch.stats[PASS_CAMERA];
+            std::stringstream title;
+            title << std::fixed << std::setprecision(1) << "FPS: " << frames / statsTime
+                  << " | camera " << cam.drawn << " drawn, " << cam.culled << " culled, " << cam.occluded << " occluded"
+                  << " (lod " << batch.visible[PASS_CAMERA].size() << "/" << batch.visible[PASS_CAMERA_MID].size()
+                  << "/" << batch.visible[PASS_IMPOSTOR].size() << ")"
+                  << " | shadow " << std::setprecision(0)
+                  << 100.0 * shadowTexels / (double(frames) * shadows.cascadeCount * SHADOW_RESOLUTION * SHADOW_RESOLUTION)
+                  << "% redrawn, " << shadowCasters / frames << " casters/frame"
+                  << " | lit overdraw " << std::setprecision(2) << litOverdraw / frames
+                  << "x (pre-pass " << (useDepthPrepass ? "on" : "off") << ")";
+            glfwSetWindowTitle(window, title.str().c_str());
+            frames = 0;
+            statsTime = 0.0f;
+            shadowTexels = 0;
+            shadowCasters = 0;
+            litOverdraw = 0.0;
+        }
 
         glfwSwapBuffers(window);
     }
 
-    for (auto& b : buildings) b.cleanup();
-    ground.cleanup();
+    litSamples.cleanup();
+    occlusion.cleanup();
+    batch.cleanup();
+    city.cleanup();
     sky.cleanup();
+    impostorAtlas.cleanup();
+    ReleaseShaderProgram(depthProgram);
+    ReleaseShaderProgram(prepassProgram);
+    ReleaseShaderProgram(buildingProgram);
+    shadows.cleanup();
+    boxMesh.cleanup();
+    facadeMaterials.cleanup();
+    textureCache.cleanup();
 
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -723,4 +1099,31 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
         glfwSetWindowShouldClose(window, GL_TRUE);
         return;
     }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        useInstancing = !useInstancing;
+        std::cout << (useInstancing ? "Instanced buildings" : "Per-building draws") << std::endl;
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        useDepthPrepass = !useDepthPrepass;
+        std::cout << (useDepthPrepass ? "Depth pre-pass on" : "Depth pre-pass off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        useOcclusion = !useOcclusion;
+        std::cout << (useOcclusion ? "Occlusion culling on" : "Occlusion culling off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+        useLod = !useLod;
+        std::cout << (useLod ? "Building LOD on" : "Building LOD off") << std::endl;
+    }
+
+    if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS) {
+        float factor = (key == GLFW_KEY_RIGHT_BRACKET) ? 1.25f : 0.8f;
+        lodMidDistance *= factor;
+        lodImpostorDistance *= factor;
+        std::cout << "LOD distances: mid " << lodMidDistance << ", impostor " << lodImpostorDistance << std::endl;
+    }
 }
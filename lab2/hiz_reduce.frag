@@ -0,0 +1,22 @@
+#version 330 core
+
+// Depth texture, or the pyramid with its base level set to the level above (see HiZOcclusion)
+uniform sampler2D source;
+
+out float farthest;
+
+// Each texel keeps the farthest depth of the 2x2 texels below it. With an odd source size
+// the last row/column also takes the leftover texel, so every source texel is covered.
+void main() {
+    ivec2 sourceSize = textureSize(source, 0);
+    ivec2 first = ivec2(gl_FragCoord.xy) * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(first + 3, sourceSize)), sourceSize - 1);
+
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+        }
+    }
+    farthest = depth;
+}
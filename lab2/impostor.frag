@@ -0,0 +1,39 @@
+#version 330 core
+
+in vec2 uv;
+in vec3 worldPos;
+flat in vec3 worldNormal;
+
+uniform sampler2D atlas;    // facade colour of the box per view, see ImpostorAtlas
+
+// Per-frame data, filled once per frame (see FrameUniforms in final.cpp)
+layout(std140) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 cameraPos;
+    vec4 cameraForward;
+    vec4 lightPosition;
+    vec4 lightDirection;
+    vec4 lightIntensity;
+    vec4 fogColorDensity;   // rgb = fog colour, a = density
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    vec4 cascadeBias;
+    vec4 shadowParams;
+};
+
+out vec3 finalColor;
+
+void main() {
+    vec4 texel = texture(atlas, uv);
+    if (texel.a < 0.5) discard;
+
+    // lit_box.frag lighting and fog, minus shadows (too far to matter)
+    vec3 albedo = texel.rgb;
+    vec3 L = normalize(lightPosition.xyz - worldPos);
+    float NdotL = max(dot(worldNormal, L), 0.0);
+    vec3 color = 0.35 * albedo + 0.85 * albedo * NdotL;
+
+    float d = length(worldPos - cameraPos.xyz);
+    float fogFactor = clamp(1.0 - exp(-fogColorDensity.a * d * d), 0.0, 1.0);
+    finalColor = mix(color, fogColorDensity.rgb, fogFactor);
+}
@@ -0,0 +1,77 @@
+#version 330 core
+
+// Per-frame data, filled once per frame (see FrameUniforms in final.cpp)
+layout(std140) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 cameraPos;
+    vec4 cameraForward;
+    vec4 lightPosition;
+    vec4 lightDirection;
+    vec4 lightIntensity;
+    vec4 fogColorDensity;
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    vec4 cascadeBias;
+    vec4 shadowParams;
+};
+
+// Per-instance index (divisor 1) into the instance pool, see BuildingBatch
+layout(location = 4) in int instanceIndex;
+uniform samplerBuffer instancePool;     // 5 texels per instance: model columns, then (layer, 0, 0, 0)
+
+uniform float atlasRows;                // facade rows in the atlas; IMPOSTOR_VIEWS columns
+
+out vec2 uv;
+out vec3 worldPos;
+flat out vec3 worldNormal;              // the provoking (last) vertex of each triangle sets it
+
+// Part of the silhouette (seen along `dir`) covered by the face on the left, and the normals
+// of the left and right faces. Only the faces turned towards the viewer are visible.
+float SplitFaces(vec2 dir, vec3 scale, out vec3 leftNormal, out vec3 rightNormal) {
+    vec3 normalX = vec3(-sign(dir.x), 0.0, 0.0);
+    vec3 normalZ = vec3(0.0, 0.0, -sign(dir.y));
+    float widthX = scale.z * abs(dir.x);
+    float widthZ = scale.x * abs(dir.y);
+
+    bool xOnRight = dir.x * dir.y > 0.0;
+    leftNormal = xOnRight ? normalZ : normalX;
+    rightNormal = xOnRight ? normalX : normalZ;
+    return (xOnRight ? widthZ : widthX) / max(widthX + widthZ, 1e-6);
+}
+
+void main() {
+    // Strip of two quads, one per visible face: column 0 = left edge, 1 = face split, 2 = right edge
+    int column = gl_VertexID >> 1;
+    float height = float(gl_VertexID & 1);
+
+    int base = instanceIndex * 5;
+    vec3 scale = vec3(texelFetch(instancePool, base).x, texelFetch(instancePool, base + 1).y,
+                      texelFetch(instancePool, base + 2).z);
+    vec3 position = texelFetch(instancePool, base + 3).xyz;
+    float layer = texelFetch(instancePool, base + 4).x;
+
+    // Horizontal direction the camera sees the building from; the quads turn to face it
+    vec2 toBox = position.xz - cameraPos.xz;
+    vec2 dir = dot(toBox, toBox) > 0.0 ? normalize(toBox) : vec2(1.0, 0.0);
+    vec3 right = vec3(-dir.y, 0.0, dir.x);
+    float halfWidth = scale.x * abs(dir.y) + scale.z * abs(dir.x);
+
+    // Nearest baked view (column k was rendered along the angle 2*pi*k / IMPOSTOR_VIEWS)
+    float step = 6.2831853 / float(IMPOSTOR_VIEWS);
+    float view = mod(floor(atan(dir.y, dir.x) / step + 0.5), float(IMPOSTOR_VIEWS));
+    vec2 viewDir = vec2(cos(view * step), sin(view * step));
+
+    // Face split of this building, and where the same split sits in the baked (unit) box
+    vec3 leftNormal, rightNormal, unused;
+    float split = SplitFaces(dir, scale, leftNormal, rightNormal);
+    float bakedSplit = SplitFaces(viewDir, vec3(1.0), unused, unused);
+
+    float x = column == 0 ? 0.0 : (column == 1 ? split : 1.0);
+    float u = column == 0 ? 0.0 : (column == 1 ? bakedSplit : 1.0);
+    worldNormal = column == 2 ? rightNormal : leftNormal;
+
+    uv = (vec2(view, layer) + vec2(u, height)) / vec2(float(IMPOSTOR_VIEWS), atlasRows);
+
+    worldPos = position + right * (halfWidth * (2.0 * x - 1.0)) + vec3(0.0, 2.0 * scale.y * height, 0.0);
+    gl_Position = viewProj * vec4(worldPos, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 330 core
+
+in vec2 uv;
+
+uniform sampler2DArray textureSampler;  // facade layers, see FacadeMaterials
+uniform float layer;
+
+out vec4 color;
+
+void main() {
+    // Unlit: impostor.frag lights each face at draw time; alpha marks the box
+    color = vec4(texture(textureSampler, vec3(uv, layer)).rgb, 1.0);
+}
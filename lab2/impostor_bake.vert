@@ -0,0 +1,14 @@
+#version 330 core
+
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 2) in vec2 vertexUV;
+
+// One impostor atlas cell: orthographic view of the unscaled box (see ImpostorAtlas)
+uniform mat4 viewProj;
+
+out vec2 uv;
+
+void main() {
+    uv = vertexUV;
+    gl_Position = viewProj * vec4(vertexPosition, 1.0);
+}
@@ -161,7 +161,7 @@ struct Skybox {
        glDeleteBuffers(1, &indexBufferID);
        glDeleteTextures(1, &textureID);
        glDeleteVertexArrays(1, &vertexArrayID);
-       glDeleteProgram(programID);
+       ReleaseShaderProgram(programID);
     }
 };
 
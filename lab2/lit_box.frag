@@ -3,26 +3,100 @@
 in vec2 uv;
 in vec3 worldPos;
 in vec3 worldNormal;
-in vec4 fragPosLightSpace;
 
-uniform sampler2D textureSampler;
-uniform sampler2D shadowMap;
-
-uniform vec3 lightPosition;
-uniform vec3 lightIntensity;
-
-uniform vec3 cameraPos;
-uniform vec3 fogColor;
-uniform float fogDensity;
+#ifdef INSTANCED
+flat in float layer;
+#else
+uniform float layer;                    // set per draw
+#endif
+uniform sampler2DArray textureSampler;  // one layer per facade, see FacadeMaterials
+uniform sampler2DArrayShadow shadowMap;   // one layer per cascade, hardware depth compare
+
+// Per-frame data, filled once per frame (see FrameUniforms in final.cpp)
+layout(std140) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 cameraPos;
+    vec4 cameraForward;     // xyz = view direction, for picking a cascade
+    vec4 lightPosition;
+    vec4 lightDirection;    // xyz = towards the light, for shadows
+    vec4 lightIntensity;
+    vec4 fogColorDensity;   // rgb = fog colour, a = density
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;     // view depth where each cascade ends
+    vec4 cascadeBias;       // depth bias per cascade
+    vec4 shadowParams;      // x = cascade count
+};
 
 out vec3 finalColor;
 
-float ShadowFactor(vec4 fragPosLS, vec3 normal, vec3 lightDir)
+#ifndef PCF_RADIUS
+#define PCF_RADIUS 1.5
+#endif
+
+#if defined(PCF_POISSON)
+#ifndef PCF_TAPS
+#define PCF_TAPS 16
+#endif
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2( 0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2( 0.34495938,  0.29387760),
+    vec2(-0.91588581,  0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543,  0.27676845), vec2( 0.97484398,  0.75648379),
+    vec2( 0.44323325, -0.97511554), vec2( 0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2( 0.79197514,  0.19090188),
+    vec2(-0.24188840,  0.99706507), vec2(-0.81409955,  0.91437590),
+    vec2( 0.19984126,  0.78641367), vec2( 0.14383161, -0.14100790));
+#elif defined(PCF_GRID)
+#ifndef PCF_GRID_SIZE
+#define PCF_GRID_SIZE 3
+#endif
+#endif
+
+// Fraction of the kernel around `coords` that is lit. Every tap is itself a 2x2 bilinear
+// compare (LINEAR filtering on a compare-mode texture), so even one tap is soft.
+float FilterShadow(vec2 coords, float cascadeLayer, float ref)
+{
+    vec2 texel = PCF_RADIUS / vec2(textureSize(shadowMap, 0).xy);
+#if defined(PCF_POISSON)
+    // Rotate the disk per pixel so the few taps turn into fine noise instead of banding
+    float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    float lit = 0.0;
+    for (int i = 0; i < PCF_TAPS; ++i) {
+        lit += texture(shadowMap, vec4(coords + rotation * poissonDisk[i] * texel, cascadeLayer, ref));
+    }
+    return lit / float(PCF_TAPS);
+#elif defined(PCF_GRID)
+    // Grid turned by atan(1/2), so its rows never line up with the texel rows
+    const mat2 rotation = mat2(0.894427, 0.447214, -0.447214, 0.894427);
+    const float extent = 0.5 * float(PCF_GRID_SIZE - 1);
+    float lit = 0.0;
+    for (int y = 0; y < PCF_GRID_SIZE; ++y) {
+        for (int x = 0; x < PCF_GRID_SIZE; ++x) {
+            vec2 offset = (vec2(x, y) - extent) / max(extent, 1.0);
+            lit += texture(shadowMap, vec4(coords + rotation * offset * texel, cascadeLayer, ref));
+        }
+    }
+    return lit / float(PCF_GRID_SIZE * PCF_GRID_SIZE);
+#else
+    return texture(shadowMap, vec4(coords, cascadeLayer, ref));
+#endif
+}
+
+// Shadow term for a world position, from the cascade that covers its view depth
+float ShadowFactor(vec3 worldPos, vec3 normal)
 {
-    // Perspective divide
-    vec3 projCoords = fragPosLS.xyz / fragPosLS.w;
-    // To [0,1]
-    projCoords = projCoords * 0.5 + 0.5;
+    int count = int(shadowParams.x);
+    float viewDepth = dot(worldPos - cameraPos.xyz, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < count && viewDepth > cascadeSplits[cascade]) cascade++;
+
+    // Beyond the shadow distance -> treat as lit
+    if (cascade == count) return 1.0;
+
+    vec4 fragPosLS = cascadeMatrices[cascade] * vec4(worldPos, 1.0);
+    // Orthographic, so no perspective divide; to [0,1]
+    vec3 projCoords = fragPosLS.xyz * 0.5 + 0.5;
 
     // Outside shadow map -> treat as lit
     if (projCoords.x < 0.0 || projCoords.x > 1.0 ||
@@ -30,24 +104,21 @@ float ShadowFactor(vec4 fragPosLS, vec3 normal, vec3 lightDir)
         projCoords.z < 0.0 || projCoords.z > 1.0)
         return 1.0;
 
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
-    float currentDepth = projCoords.z;
-
-    // Bias reduces shadow acne; slope-scaled bias helps
-    float bias = max(0.002 * (1.0 - dot(normal, lightDir)), 0.0008);
+    // Bias reduces shadow acne; scaled up on surfaces at grazing angles to the light
+    float bias = cascadeBias[cascade] * (1.0 + 2.0 * (1.0 - max(dot(normal, lightDirection.xyz), 0.0)));
 
-    // Simple hard shadow
-    return (currentDepth - bias > closestDepth) ? 0.25 : 1.0;
+    float lit = FilterShadow(projCoords.xy, float(cascade), projCoords.z - bias);
+    return mix(0.25, 1.0, lit);
 }
 
 void main() {
-    vec3 albedo = texture(textureSampler, uv).rgb;
+    vec3 albedo = texture(textureSampler, vec3(uv, layer)).rgb;
 
     vec3 N = normalize(worldNormal);
-    vec3 L = normalize(lightPosition - worldPos);
+    vec3 L = normalize(lightPosition.xyz - worldPos);
     float NdotL = max(dot(N, L), 0.0);
 
-    float shadow = ShadowFactor(fragPosLightSpace, N, L);
+    float shadow = ShadowFactor(worldPos, N);
 
     vec3 ambient = 0.35 * albedo;
     vec3 diffuse = 0.85 * albedo * NdotL * shadow;
@@ -55,10 +126,10 @@ void main() {
     vec3 color = ambient + diffuse;
 
     // --- FOG ---
-    float d = length(worldPos - cameraPos);
-    float fogFactor = 1.0 - exp(-fogDensity * d * d);
+    float d = length(worldPos - cameraPos.xyz);
+    float fogFactor = 1.0 - exp(-fogColorDensity.a * d * d);
     fogFactor = clamp(fogFactor, 0.0, 1.0);
-    color = mix(color, fogColor, fogFactor);
+    color = mix(color, fogColorDensity.rgb, fogFactor);
 
     finalColor = color;
 
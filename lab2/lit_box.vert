@@ -4,24 +4,56 @@ layout(location = 0) in vec3 vertexPosition;
 layout(location = 2) in vec2 vertexUV;
 layout(location = 3) in vec3 vertexNormal;
 
-uniform mat4 MVP;
+// Per-frame data, filled once per frame (see FrameUniforms in final.cpp)
+layout(std140) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 cameraPos;
+    vec4 cameraForward;     // xyz = view direction, for picking a cascade
+    vec4 lightPosition;
+    vec4 lightDirection;    // xyz = towards the light, for shadows
+    vec4 lightIntensity;
+    vec4 fogColorDensity;   // rgb = fog colour, a = density
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;     // view depth where each cascade ends
+    vec4 cascadeBias;       // depth bias per cascade
+    vec4 shadowParams;      // x = cascade count
+};
+
+#ifdef INSTANCED
+// Per-instance index (divisor 1) into the instance pool, see BuildingBatch
+layout(location = 4) in int instanceIndex;
+uniform samplerBuffer instancePool;     // 5 texels per instance: model columns, then (layer, 0, 0, 0)
+
+flat out float layer;
+#else
 uniform mat4 Model;
-uniform mat4 lightSpaceMatrix;
+#endif
 
 out vec2 uv;
 out vec3 worldPos;
 out vec3 worldNormal;
-out vec4 fragPosLightSpace;
+
+// Matches the depth pre-pass (shadow_depth.vert with CAMERA_DEPTH) bit for bit
+invariant gl_Position;
 
 void main() {
     uv = vertexUV;
 
+#ifdef INSTANCED
+    int base = instanceIndex * 5;
+    mat4 instanceModel = mat4(texelFetch(instancePool, base), texelFetch(instancePool, base + 1),
+                              texelFetch(instancePool, base + 2), texelFetch(instancePool, base + 3));
+    vec4 wp = instanceModel * vec4(vertexPosition, 1.0);
+    // Inverse-transpose without inverse(): M = R*S, so R*S^-1*n = mat3(M) * (n / S^2)
+    mat3 m = mat3(instanceModel);
+    vec3 scale2 = vec3(dot(m[0], m[0]), dot(m[1], m[1]), dot(m[2], m[2]));
+    worldNormal = m * (vertexNormal / scale2);
+    layer = texelFetch(instancePool, base + 4).x;
+#else
     vec4 wp = Model * vec4(vertexPosition, 1.0);
-    worldPos = wp.xyz;
-
     worldNormal = mat3(transpose(inverse(Model))) * vertexNormal;
+#endif
+    worldPos = wp.xyz;
 
-    fragPosLightSpace = lightSpaceMatrix * wp;
-
-    gl_Position = MVP * vec4(vertexPosition, 1.0);
+    gl_Position = viewProj * wp;
 }
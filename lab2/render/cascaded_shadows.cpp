@@ -0,0 +1,289 @@
+#include "cascaded_shadows.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+void CascadedShadows::initialize(int count, int size) {
+    cascadeCount = std::min(std::max(count, 1), MAX_SHADOW_CASCADES);
+    resolution = size;
+
+    glGenTextures(1, &depthArrayID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthArrayID);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, cascadeCount,
+                 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+    // Sampled through sampler2DArrayShadow: with LINEAR filtering every lookup returns a
+    // bilinear blend of four depth comparisons (hardware 2x2 PCF)
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    // Outside a cascade reads as "far", i.e. lit
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+    glGenFramebuffers(1, &framebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArrayID, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Shadow cascade framebuffer is incomplete" << std::endl;
+    }
+
+    // Shifting a layer goes through this copy, since a blit may not overlap itself
+    glGenTextures(1, &scratchDepthID);
+    glBindTexture(GL_TEXTURE_2D, scratchDepthID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &scratchFramebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, scratchFramebufferID);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, scratchDepthID, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    lightRotation = glm::mat4(1.0f);
+    lightDir = glm::vec3(0.0f);
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+        matrices[i] = glm::mat4(1.0f);
+        splitFar[i] = 0.0f;
+        depthBias[i] = 0.0f;
+        windows[i] = Window();
+    }
+}
+
+void CascadedShadows::markAll(Window& w) {
+    std::fill(w.dirty, w.dirty + SHADOW_TILES * SHADOW_TILES, true);
+}
+
+// Light-space ortho over tiles [x0, x1) x [y0, y1) of the window
+glm::mat4 CascadedShadows::windowMatrix(const Window& w, float x0, float y0, float x1, float y1) const {
+    const float tile = 2.0f * w.radius / SHADOW_TILES;
+    const float originX = (w.tileX - SHADOW_TILES / 2) * tile;
+    const float originY = (w.tileY - SHADOW_TILES / 2) * tile;
+    return glm::ortho(originX + x0 * tile, originX + x1 * tile, originY + y0 * tile, originY + y1 * tile,
+                      w.nearDepth, w.farDepth) * lightRotation;
+}
+
+void CascadedShadows::update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& toLight) {
+    // Practical split scheme: blend of logarithmic (even texel density) and uniform splits
+    const float n = std::max(nearPlane, 1.0f);
+    const float f = shadowDistance;
+    for (int i = 0; i < cascadeCount; ++i) {
+        float p = float(i + 1) / cascadeCount;
+        float logSplit = n * std::pow(f / n, p);
+        float uniformSplit = n + (f - n) * p;
+        splitFar[i] = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+    }
+
+    // The tile grid lives in light space, so a new direction invalidates everything
+    const glm::vec3 dir = glm::normalize(toLight);
+    if (dir != lightDir) {
+        lightDir = dir;
+        const glm::vec3 up = std::fabs(dir.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+        lightRotation = glm::lookAt(glm::vec3(0.0f), -dir, up);
+        for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) windows[i].valid = false;
+    }
+
+    const glm::mat4 invView = glm::inverse(view);
+    const float tanHalf = std::tan(fovY * 0.5f);
+
+    float sliceNear = nearPlane;
+    for (int i = 0; i < cascadeCount; ++i) {
+        float sliceFar = splitFar[i];
+
+        // Slice corners in view space (looking down -Z). Fitting the sphere there keeps its
+        // radius bit-identical from frame to frame; only the centre moves with the camera.
+        glm::vec3 corners[8];
+        for (int c = 0; c < 8; ++c) {
+            float z = (c & 4) ? sliceFar : sliceNear;
+            float halfH = z * tanHalf;
+            float halfW = halfH * aspect;
+            corners[c] = glm::vec3((c & 1) ? halfW : -halfW, (c & 2) ? halfH : -halfH, -z);
+        }
+
+        glm::vec3 viewCenter(0.0f);
+        for (int c = 0; c < 8; ++c) viewCenter += corners[c];
+        viewCenter /= 8.0f;
+
+        float radius = 0.0f;
+        for (int c = 0; c < 8; ++c) radius = std::max(radius, glm::length(corners[c] - viewCenter));
+        glm::vec3 center = glm::vec3(invView * glm::vec4(viewCenter, 1.0f));
+
+        // The bounding sphere has a fixed size for a given projection; the window adds half
+        // a tile on each side so it still covers the sphere after snapping to the tile grid
+        Window& w = windows[i];
+        float windowRadius = std::ceil(radius * SHADOW_TILES / (SHADOW_TILES - 1) * 16.0f) / 16.0f;
+        if (windowRadius != w.radius) {
+            w.radius = windowRadius;
+            w.valid = false;
+        }
+
+        const float tile = 2.0f * w.radius / SHADOW_TILES;
+        glm::vec3 c = glm::vec3(lightRotation * glm::vec4(center, 1.0f));
+        int tileX = int(std::floor(c.x / tile + 0.5f));
+        int tileY = int(std::floor(c.y / tile + 0.5f));
+
+        // Depth along the light is anchored in coarse steps, so cached depth stays valid while shifting
+        float depth = -c.z;
+        float anchor = std::floor(depth / depthStep + 0.5f) * depthStep;
+
+        if (!w.valid || anchor != w.depthAnchor) {
+            w.depthAnchor = anchor;
+            w.nearDepth = anchor - depthStep - w.radius - casterMargin;
+            w.farDepth = anchor + depthStep + w.radius;
+            w.tileX = tileX;
+            w.tileY = tileY;
+            w.valid = true;
+            markAll(w);
+        } else if (tileX != w.tileX || tileY != w.tileY) {
+            shift(i, tileX - w.tileX, tileY - w.tileY);
+            w.tileX = tileX;
+            w.tileY = tileY;
+        }
+
+        matrices[i] = windowMatrix(w, 0.0f, 0.0f, float(SHADOW_TILES), float(SHADOW_TILES));
+
+        float texelWorld = 2.0f * w.radius / resolution;
+        depthBias[i] = 1.5f * texelWorld / (w.farDepth - w.nearDepth);
+
+        sliceNear = sliceFar;
+    }
+}
+
+// Moves the window by (dx, dy) tiles: cached depth follows its tiles, the exposed edge is dirty
+void CascadedShadows::shift(int cascade, int dx, int dy) {
+    Window& w = windows[cascade];
+    if (std::abs(dx) >= SHADOW_TILES || std::abs(dy) >= SHADOW_TILES) {
+        markAll(w);
+        return;
+    }
+
+    const int texelsPerTile = resolution / SHADOW_TILES;
+    const int du = dx * texelsPerTile, dv = dy * texelsPerTile;
+    const int srcX0 = std::max(0, du), srcX1 = resolution + std::min(0, du);
+    const int srcY0 = std::max(0, dv), srcY1 = resolution + std::min(0, dv);
+    const int dstX0 = srcX0 - du, dstX1 = srcX1 - du;
+    const int dstY0 = srcY0 - dv, dstY1 = srcY1 - dv;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebufferID);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArrayID, 0, cascade);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, scratchFramebufferID);
+    glBlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scratchFramebufferID);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebufferID);
+    glBlitFramebuffer(dstX0, dstY0, dstX1, dstY1, dstX0, dstY0, dstX1, dstY1, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    bool moved[SHADOW_TILES * SHADOW_TILES];
+    for (int y = 0; y < SHADOW_TILES; ++y) {
+        for (int x = 0; x < SHADOW_TILES; ++x) {
+            int ox = x + dx, oy = y + dy;
+            bool inside = ox >= 0 && ox < SHADOW_TILES && oy >= 0 && oy < SHADOW_TILES;
+            moved[y * SHADOW_TILES + x] = inside ? w.dirty[oy * SHADOW_TILES + ox] : true;
+        }
+    }
+    std::copy(moved, moved + SHADOW_TILES * SHADOW_TILES, w.dirty);
+}
+
+void CascadedShadows::invalidate(const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    // Footprint of the box in light space; a caster only ever writes depth inside it
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    for (int c = 0; c < 8; ++c) {
+        glm::vec3 p((c & 1) ? maxCorner.x : minCorner.x, (c & 2) ? maxCorner.y : minCorner.y, (c & 4) ? maxCorner.z : minCorner.z);
+        glm::vec2 ls = glm::vec2(lightRotation * glm::vec4(p, 1.0f));
+        lo = glm::min(lo, ls);
+        hi = glm::max(hi, ls);
+    }
+
+    for (int i = 0; i < cascadeCount; ++i) {
+        Window& w = windows[i];
+        if (!w.valid) continue;
+
+        const float tile = 2.0f * w.radius / SHADOW_TILES;
+        int x0 = int(std::floor(lo.x / tile)) - (w.tileX - SHADOW_TILES / 2);
+        int x1 = int(std::floor(hi.x / tile)) - (w.tileX - SHADOW_TILES / 2);
+        int y0 = int(std::floor(lo.y / tile)) - (w.tileY - SHADOW_TILES / 2);
+        int y1 = int(std::floor(hi.y / tile)) - (w.tileY - SHADOW_TILES / 2);
+        if (x1 < 0 || y1 < 0 || x0 >= SHADOW_TILES || y0 >= SHADOW_TILES) continue;
+
+        x0 = std::max(x0, 0); y0 = std::max(y0, 0);
+        x1 = std::min(x1, SHADOW_TILES - 1); y1 = std::min(y1, SHADOW_TILES - 1);
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) w.dirty[y * SHADOW_TILES + x] = true;
+        }
+    }
+}
+
+void CascadedShadows::collectRegions(std::vector<ShadowRegion>& out) {
+    const int texelsPerTile = resolution / SHADOW_TILES;
+
+    for (int i = 0; i < cascadeCount; ++i) {
+        Window& w = windows[i];
+        bool* dirty = w.dirty;
+
+        // Greedy: take a run along the row, then grow it down while the rows below match
+        for (int y = 0; y < SHADOW_TILES; ++y) {
+            for (int x = 0; x < SHADOW_TILES; ++x) {
+                if (!dirty[y * SHADOW_TILES + x]) continue;
+
+                int x1 = x;
+                while (x1 + 1 < SHADOW_TILES && dirty[y * SHADOW_TILES + x1 + 1]) x1++;
+
+                int y1 = y;
+                for (;;) {
+                    if (y1 + 1 >= SHADOW_TILES) break;
+                    bool full = true;
+                    for (int k = x; k <= x1 && full; ++k) full = dirty[(y1 + 1) * SHADOW_TILES + k];
+                    if (!full) break;
+                    y1++;
+                }
+
+                for (int yy = y; yy <= y1; ++yy) {
+                    for (int k = x; k <= x1; ++k) dirty[yy * SHADOW_TILES + k] = false;
+                }
+
+                ShadowRegion r;
+                r.cascade = i;
+                r.x = x * texelsPerTile;
+                r.y = y * texelsPerTile;
+                r.width = (x1 - x + 1) * texelsPerTile;
+                r.height = (y1 - y + 1) * texelsPerTile;
+                r.cullMatrix = windowMatrix(w, float(x), float(y), float(x1 + 1), float(y1 + 1));
+                out.push_back(r);
+            }
+        }
+    }
+}
+
+void CascadedShadows::beginRegion(const ShadowRegion& region) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthArrayID, 0, region.cascade);
+    glViewport(0, 0, resolution, resolution);
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(region.x, region.y, region.width, region.height);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void CascadedShadows::end() {
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void CascadedShadows::cleanup() {
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteFramebuffers(1, &scratchFramebufferID);
+    glDeleteTextures(1, &depthArrayID);
+    glDeleteTextures(1, &scratchDepthID);
+}
@@ -0,0 +1,87 @@
+#ifndef _CASCADED_SHADOWS_H_
+#define _CASCADED_SHADOWS_H_
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Upper bound baked into the FrameUniforms block (cascadeMatrices[4] in the shaders)
+static const int MAX_SHADOW_CASCADES = 4;
+
+// Each cascade window is split into SHADOW_TILES x SHADOW_TILES world-anchored tiles
+static const int SHADOW_TILES = 16;
+
+// Part of one cascade layer that has to be re-rendered, in texels. `cullMatrix` covers
+// just this rectangle, for picking the casters to draw.
+struct ShadowRegion {
+    int cascade;
+    int x, y, width, height;
+    glm::mat4 cullMatrix;
+};
+
+// Directional-light cascaded shadow maps: the camera frustum up to `shadowDistance` is
+// split into slices, each covered by its own orthographic light matrix and one layer
+// of a depth texture array.
+//
+// The layers double as a cache. A cascade's window only moves in whole tiles on a grid
+// anchored in light space, so when it moves the cached depth is shifted with a blit and
+// only the newly exposed tiles, plus tiles whose casters changed (see invalidate()),
+// are rendered again. With a still camera and a static city nothing is re-rendered.
+struct CascadedShadows {
+    int cascadeCount = 3;
+    int resolution = 1024;
+    float shadowDistance = 1200.0f;     // view depth beyond which nothing is shadowed
+    float splitLambda = 0.6f;           // 0 = uniform splits, 1 = logarithmic
+    float casterMargin = 500.0f;        // extends each light volume towards the light for off-slice casters
+    float depthStep = 1024.0f;          // depth range is re-anchored (full re-render) in steps of this
+
+    GLuint depthArrayID = 0;
+    GLuint framebufferID = 0;
+
+    // Filled by update()
+    glm::mat4 matrices[MAX_SHADOW_CASCADES];
+    float splitFar[MAX_SHADOW_CASCADES];    // view depth where each cascade ends
+    float depthBias[MAX_SHADOW_CASCADES];   // about 1.5 texels, in that cascade's depth units
+
+    void initialize(int cascadeCount, int resolution);
+
+    // Fits one window per slice of the camera frustum and moves the cached depth along
+    // with it. `toLight` points from the scene towards the light.
+    void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& toLight);
+
+    // Casters inside this world box were added, removed or moved.
+    void invalidate(const glm::vec3& minCorner, const glm::vec3& maxCorner);
+
+    // Dirty tiles merged into rectangles; clears the dirty flags.
+    void collectRegions(std::vector<ShadowRegion>& out);
+
+    // Binds the region's layer as the depth target and clears just that rectangle
+    // (scissor stays enabled until end()).
+    void beginRegion(const ShadowRegion& region);
+    void end();
+
+    void cleanup();
+
+private:
+    struct Window {
+        bool valid = false;
+        float radius = 0.0f;            // half-width of the window in light space
+        int tileX = 0, tileY = 0;       // window centre, in tiles of the light-space grid
+        float depthAnchor = 0.0f;
+        float nearDepth = 0.0f, farDepth = 0.0f;
+        bool dirty[SHADOW_TILES * SHADOW_TILES];
+    };
+
+    Window windows[MAX_SHADOW_CASCADES];
+    glm::mat4 lightRotation;
+    glm::vec3 lightDir;
+
+    GLuint scratchDepthID = 0;
+    GLuint scratchFramebufferID = 0;
+
+    void markAll(Window& w);
+    void shift(int cascade, int dx, int dy);
+    glm::mat4 windowMatrix(const Window& w, float x0, float y0, float x1, float y1) const;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "culling.h"
+
+#include <cmath>
+
+Frustum Frustum::fromMatrix(const glm::mat4& m) {
+    // glm is column-major: row i of the matrix is (m[0][i], m[1][i], m[2][i], m[3][i])
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum f;
+    f.planes[0] = row3 + row0;  // left
+    f.planes[1] = row3 - row0;  // right
+    f.planes[2] = row3 + row1;  // bottom
+    f.planes[3] = row3 - row1;  // top
+    f.planes[4] = row3 + row2;  // near
+    f.planes[5] = row3 - row2;  // far
+
+    for (int i = 0; i < 6; ++i) {
+        float len = glm::length(glm::vec3(f.planes[i]));
+        if (len > 0.0f) f.planes[i] /= len;
+    }
+    return f;
+}
+
+void Frustum::corners(const glm::mat4& viewProj, glm::vec3 out[8]) {
+    glm::mat4 inv = glm::inverse(viewProj);
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+        glm::vec4 world = inv * ndc;
+        out[i] = glm::vec3(world) / world.w;
+    }
+}
+
+void AabbSoA::clear() {
+    centerX.clear(); centerY.clear(); centerZ.clear();
+    extentX.clear(); extentY.clear(); extentZ.clear();
+}
+
+void AabbSoA::reserve(size_t count) {
+    centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count);
+    extentX.reserve(count); extentY.reserve(count); extentZ.reserve(count);
+}
+
+void AabbSoA::push(const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    glm::vec3 c = (minCorner + maxCorner) * 0.5f;
+    glm::vec3 e = (maxCorner - minCorner) * 0.5f;
+    centerX.push_back(c.x); centerY.push_back(c.y); centerZ.push_back(c.z);
+    extentX.push_back(e.x); extentY.push_back(e.y); extentZ.push_back(e.z);
+}
+
+void AabbSoA::set(size_t index, const glm::vec3& minCorner, const glm::vec3& maxCorner) {
+    glm::vec3 c = (minCorner + maxCorner) * 0.5f;
+    glm::vec3 e = (maxCorner - minCorner) * 0.5f;
+    centerX[index] = c.x; centerY[index] = c.y; centerZ[index] = c.z;
+    extentX[index] = e.x; extentY[index] = e.y; extentZ[index] = e.z;
+}
+
+void CullAabbs(const Frustum& frustum, const AabbSoA& boxes, std::vector<int>& visible, CullStats& stats,
+               CullScratch& scratch) {
+    const size_t n = boxes.size();
+
+    // One pass per plane over all boxes: branch-free inner loop over SoA arrays
+    std::vector<unsigned char>& inside = scratch.inside;
+    inside.assign(n, 1);
+
+    const float* cx = n ? &boxes.centerX[0] : NULL;
+    const float* cy = n ? &boxes.centerY[0] : NULL;
+    const float* cz = n ? &boxes.centerZ[0] : NULL;
+    const float* ex = n ? &boxes.extentX[0] : NULL;
+    const float* ey = n ? &boxes.extentY[0] : NULL;
+    const float* ez = n ? &boxes.extentZ[0] : NULL;
+    unsigned char* in = n ? &inside[0] : NULL;
+
+    for (int p = 0; p < 6; ++p) {
+        const float nx = frustum.planes[p].x, ny = frustum.planes[p].y, nz = frustum.planes[p].z;
+        const float d = frustum.planes[p].w;
+        const float ax = std::fabs(nx), ay = std::fabs(ny), az = std::fabs(nz);
+
+        for (size_t i = 0; i < n; ++i) {
+            // Signed distance of the centre plus the box's projected radius onto the normal
+            float dist = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+            float radius = ax * ex[i] + ay * ey[i] + az * ez[i];
+            in[i] &= (unsigned char)(dist + radius >= 0.0f);
+        }
+    }
+
+    visible.clear();
+    for (size_t i = 0; i < n; ++i) {
+        if (in[i]) visible.push_back(int(i));
+    }
+
+    stats.tested = int(n);
+    stats.drawn = int(visible.size());
+    stats.culled = stats.tested - stats.drawn;
+    stats.occluded = 0;
+}
+
+void CullAabbs(const Frustum& frustum, const AabbSoA& boxes, const std::vector<int>& candidates,
+               std::vector<int>& visible, CullStats& stats, CullScratch& scratch) {
+    // Gather the candidates into a dense SoA so the plane loop stays contiguous
+    AabbSoA& gathered = scratch.gathered;
+    gathered.clear();
+    gathered.reserve(candidates.size());
+    for (int i : candidates) {
+        gathered.centerX.push_back(boxes.centerX[i]);
+        gathered.centerY.push_back(boxes.centerY[i]);
+        gathered.centerZ.push_back(boxes.centerZ[i]);
+        gathered.extentX.push_back(boxes.extentX[i]);
+        gathered.extentY.push_back(boxes.extentY[i]);
+        gathered.extentZ.push_back(boxes.extentZ[i]);
+    }
+
+    CullAabbs(frustum, gathered, visible, stats, scratch);
+    for (size_t i = 0; i < visible.size(); ++i) visible[i] = candidates[visible[i]];
+}
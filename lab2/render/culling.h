@@ -0,0 +1,53 @@
+#ifndef _CULLING_H_
+#define _CULLING_H_
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Six planes (left, right, bottom, top, near, far) as (n, d) with n.p + d >= 0 inside
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction; works for perspective and orthographic view-projections
+    static Frustum fromMatrix(const glm::mat4& viewProj);
+
+    // World-space corners of the clip volume (near face first), via the inverse matrix
+    static void corners(const glm::mat4& viewProj, glm::vec3 out[8]);
+};
+
+// Axis-aligned boxes as centre/half-extent arrays, so the plane test streams over
+// contiguous floats and the compiler can vectorise it
+struct AabbSoA {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    void clear();
+    void reserve(size_t count);
+    void push(const glm::vec3& minCorner, const glm::vec3& maxCorner);
+    void set(size_t index, const glm::vec3& minCorner, const glm::vec3& maxCorner);
+    size_t size() const { return centerX.size(); }
+};
+
+struct CullStats {
+    int tested = 0;
+    int culled = 0;
+    int drawn = 0;
+    int occluded = 0;   // passed the frustum test but hidden (see HiZOcclusion), not in `drawn`
+};
+
+// Working memory for CullAabbs, owned by the caller and kept between calls so culling
+// does not allocate every frame. One per thread that culls.
+struct CullScratch {
+    std::vector<unsigned char> inside;  // per box: still inside every plane tested so far
+    AabbSoA gathered;                   // the candidates' boxes, packed densely
+};
+
+// Replaces `visible` with the indices of boxes that intersect the frustum (conservative)
+void CullAabbs(const Frustum& frustum, const AabbSoA& boxes, std::vector<int>& visible, CullStats& stats,
+               CullScratch& scratch);
+
+// Same test restricted to `candidates` (e.g. from a spatial query); indices refer to `boxes`
+void CullAabbs(const Frustum& frustum, const AabbSoA& boxes, const std::vector<int>& candidates,
+               std::vector<int>& visible, CullStats& stats, CullScratch& scratch);
+
+#endif
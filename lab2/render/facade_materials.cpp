@@ -0,0 +1,121 @@
+#include "facade_materials.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+void FacadeMaterials::initialize(TextureCache& textureCache, int w, int h, int initialCapacity) {
+    cache = &textureCache;
+    width = w;
+    height = h;
+    levels = FullMipCount(width, height);
+    capacity = std::max(initialCapacity, 1);
+    count = 0;
+
+    allocate(arrayID, capacity);
+    glGenFramebuffers(1, &copyFramebufferID);
+}
+
+// RGBA8 rather than RGB8: it is colour-renderable, which the GPU copy in grow() needs
+void FacadeMaterials::allocate(GLuint& texture, int layerCount) {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (int level = 0; level < levels; ++level) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(width >> level, 1), std::max(height >> level, 1),
+                     layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+}
+
+void FacadeMaterials::grow(int newCapacity) {
+    GLuint grown;
+    allocate(grown, newCapacity);
+
+    // Layer by layer and level by level through a read framebuffer (no glCopyImageSubData in 3.3)
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFramebufferID);
+    for (int level = 0; level < levels; ++level) {
+        int w = std::max(width >> level, 1), h = std::max(height >> level, 1);
+        for (int layer = 0; layer < count; ++layer) {
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, arrayID, level, layer);
+            glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, 0, 0, w, h);
+        }
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    glDeleteTextures(1, &arrayID);
+    arrayID = grown;
+    capacity = newCapacity;
+}
+
+void FacadeMaterials::uploadLayer(int layer, const DecodedImage& image) {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrayID);
+    // RGB rows are not 4-byte aligned for every width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (image.width == width && image.height == height && image.levels >= levels) {
+        // Baked at the common size: every level goes up as it is
+        for (int l = 0; l < levels; ++l) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, image.levelWidth(l), image.levelHeight(l), 1,
+                            GL_RGB, GL_UNSIGNED_BYTE, image.level(l));
+        }
+    } else {
+        DecodedImage level, next;
+        if (image.width != width || image.height != height) {
+            TextureCache::resize(image, width, height, level);
+        } else {
+            level.width = width;
+            level.height = height;
+            level.pixels.assign(image.level(0), image.level(0) + size_t(width) * height * 3);
+        }
+
+        for (int l = 0; l < levels; ++l) {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, level.width, level.height, 1,
+                            GL_RGB, GL_UNSIGNED_BYTE, &level.pixels[0]);
+            if (l + 1 < levels) {
+                DownsampleImage(level, next);
+                std::swap(level, next);
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+int FacadeMaterials::add(const char* path) {
+    std::map<std::string, int>::iterator it = layers.find(path);
+    if (it != layers.end()) return it->second;
+
+    if (count == capacity) grow(capacity * 2);
+    int layer = count++;
+    layers[path] = layer;
+
+    const DecodedImage* image = cache->image(path);
+    if (image) {
+        uploadLayer(layer, *image);
+    } else {
+        std::cout << "Failed to load texture " << path << std::endl;
+        DecodedImage grey;
+        grey.width = width;
+        grey.height = height;
+        grey.pixels.assign(size_t(width) * height * 3, 128);
+        uploadLayer(layer, grey);
+    }
+    // The layer lives on the GPU now; later growth copies it there
+    cache->release(path);
+    return layer;
+}
+
+int FacadeMaterials::layerOf(const char* path) const {
+    std::map<std::string, int>::const_iterator it = layers.find(path);
+    return it != layers.end() ? it->second : -1;
+}
+
+void FacadeMaterials::cleanup() {
+    glDeleteFramebuffers(1, &copyFramebufferID);
+    glDeleteTextures(1, &arrayID);
+    layers.clear();
+    count = capacity = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _FACADE_MATERIALS_H_
+#define _FACADE_MATERIALS_H_
+
+#include "texture_cache.h"
+
+#include <glad/gl.h>
+#include <map>
+#include <string>
+
+// Every facade image as one layer of a GL_TEXTURE_2D_ARRAY, resampled to a common size
+// with its own full mip chain. Buildings carry a layer index instead of a texture, so
+// any mix of facades draws without rebinding.
+//
+// Facades can be added at any time. A new layer is decoded, mipmapped and uploaded on
+// its own; when the array is full it is reallocated at twice the capacity and the
+// existing layers are copied over on the GPU, so nothing already in it is re-decoded.
+struct FacadeMaterials {
+    int width = 0;
+    int height = 0;
+    int levels = 0;
+    int capacity = 0;
+    int count = 0;
+    GLuint arrayID = 0;     // changes when the array grows; read it at bind time
+
+    // `width` x `height` should be powers of two so every mip level halves evenly
+    void initialize(TextureCache& cache, int width, int height, int initialCapacity);
+
+    // Layer for `path`, added the first time it is asked for. A file that fails to
+    // decode still gets a (flat grey) layer, so the index stays valid.
+    int add(const char* path);
+
+    // Layer for `path`, or -1 if it was never added
+    int layerOf(const char* path) const;
+
+    void cleanup();
+
+private:
+    TextureCache* cache = 0;
+    std::map<std::string, int> layers;
+    GLuint copyFramebufferID = 0;
+
+    void allocate(GLuint& texture, int layerCount);
+    void grow(int newCapacity);
+    void uploadLayer(int layer, const DecodedImage& image);
+};
+
+#endif
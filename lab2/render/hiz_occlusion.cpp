@@ -0,0 +1,241 @@
+#include "hiz_occlusion.h"
+#include "shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void HiZOcclusion::initialize() {
+    glGenFramebuffers(1, &framebufferID);
+    glGenVertexArrays(1, &vertexArrayID);
+    for (int i = 0; i < READBACK_FRAMES; ++i) glGenBuffers(1, &readbacks[i].bufferID);
+
+    programID = LoadShadersFromFile("lab2/hiz_reduce.vert", "lab2/hiz_reduce.frag");
+    glUseProgram(programID);
+    glUniform1i(glGetUniformLocation(programID, "source"), 0);
+}
+
+void HiZOcclusion::allocate(int width, int height) {
+    screenWidth = width;
+    screenHeight = height;
+    valid = false;
+
+    glDeleteTextures(1, &depthTextureID);
+    glGenTextures(1, &depthTextureID);
+    glBindTexture(GL_TEXTURE_2D, depthTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // Level 0 is half the screen; stop at the first level narrow enough to read back
+    readbackLevel = 0;
+    while ((width >> (readbackLevel + 1)) > readbackMaxWidth && (width >> (readbackLevel + 2)) > 0) readbackLevel++;
+
+    glDeleteTextures(1, &pyramidTextureID);
+    glGenTextures(1, &pyramidTextureID);
+    glBindTexture(GL_TEXTURE_2D, pyramidTextureID);
+    for (int level = 0; level <= readbackLevel; ++level) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(width >> (level + 1), 1), std::max(height >> (level + 1), 1),
+                     0, GL_RED, GL_FLOAT, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, readbackLevel);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Readbacks still in flight have the old size
+    const int readbackWidth = std::max(width >> (readbackLevel + 1), 1);
+    const int readbackHeight = std::max(height >> (readbackLevel + 1), 1);
+    for (int i = 0; i < READBACK_FRAMES; ++i) {
+        Readback& rb = readbacks[i];
+        if (rb.fence) glDeleteSync(rb.fence);
+        rb.fence = 0;
+        rb.width = readbackWidth;
+        rb.height = readbackHeight;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.bufferID);
+        glBufferData(GL_PIXEL_PACK_BUFFER, readbackWidth * readbackHeight * sizeof(float), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void HiZOcclusion::capture(int width, int height, const glm::mat4& viewProj) {
+    if (width <= 0 || height <= 0) return;
+    if (width != screenWidth || height != screenHeight) allocate(width, height);
+
+    // A readback that was never picked up is simply replaced
+    Readback& rb = readbacks[frame % READBACK_FRAMES];
+    if (rb.fence) glDeleteSync(rb.fence);
+    rb.fence = 0;
+    rb.viewProj = viewProj;
+    frame++;
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTextureID);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(programID);
+    glBindVertexArray(vertexArrayID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+
+    // Each level reads the one above it; the base/max level range keeps the level being
+    // written out of the texture being sampled
+    for (int level = 0; level <= readbackLevel; ++level) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTextureID, level);
+        if (level == 0) {
+            glBindTexture(GL_TEXTURE_2D, depthTextureID);
+        } else {
+            glBindTexture(GL_TEXTURE_2D, pyramidTextureID);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        }
+        glViewport(0, 0, std::max(width >> (level + 1), 1), std::max(height >> (level + 1), 1));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindTexture(GL_TEXTURE_2D, pyramidTextureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, readbackLevel);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The last level drawn is still attached: read it into the pixel buffer (returns at once)
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.bufferID);
+    glReadPixels(0, 0, rb.width, rb.height, GL_RED, GL_FLOAT, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glViewport(0, 0, width, height);
+}
+
+void HiZOcclusion::update() {
+    for (int age = 1; age <= READBACK_FRAMES; ++age) {
+        Readback& rb = readbacks[(frame - age + READBACK_FRAMES) % READBACK_FRAMES];
+        if (!rb.fence) continue;
+        GLenum status = glClientWaitSync(rb.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.bufferID);
+        const size_t bytes = size_t(rb.width) * rb.height * sizeof(float);
+        const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (data) {
+            levels.resize(1);
+            levelSizes.assign(1, glm::ivec2(rb.width, rb.height));
+            levels[0].resize(size_t(rb.width) * rb.height);
+            memcpy(&levels[0][0], data, bytes);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            levelsViewProj = rb.viewProj;
+            buildLevels();
+            valid = true;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        // This one and anything older are done with
+        for (int older = age; older <= READBACK_FRAMES; ++older) {
+            Readback& o = readbacks[(frame - older + READBACK_FRAMES) % READBACK_FRAMES];
+            if (o.fence) glDeleteSync(o.fence);
+            o.fence = 0;
+        }
+        break;
+    }
+}
+
+// Same reduction as hiz_reduce.frag: the last row/column also takes an odd leftover
+void HiZOcclusion::buildLevels() {
+    while (levelSizes.back().x > 1 || levelSizes.back().y > 1) {
+        const glm::ivec2 src = levelSizes.back();
+        const glm::ivec2 dst(std::max(src.x >> 1, 1), std::max(src.y >> 1, 1));
+        std::vector<float> next(size_t(dst.x) * dst.y);
+        const std::vector<float>& above = levels.back();
+
+        for (int y = 0; y < dst.y; ++y) {
+            int y1 = (y == dst.y - 1) ? src.y - 1 : 2 * y + 1;
+            for (int x = 0; x < dst.x; ++x) {
+                int x1 = (x == dst.x - 1) ? src.x - 1 : 2 * x + 1;
+                float farthest = 0.0f;
+                for (int sy = 2 * y; sy <= y1; ++sy)
+                    for (int sx = 2 * x; sx <= x1; ++sx)
+                        farthest = std::max(farthest, above[size_t(sy) * src.x + sx]);
+                next[size_t(y) * dst.x + x] = farthest;
+            }
+        }
+        levels.push_back(next);
+        levelSizes.push_back(dst);
+    }
+}
+
+bool HiZOcclusion::occluded(const glm::vec3& center, const glm::vec3& extent) const {
+    // Screen rectangle and nearest depth of the box in the frame the pyramid came from
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    float nearest = 1e30f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 corner = center + extent * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+        glm::vec4 clip = levelsViewProj * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-4f) return false;     // reaches behind the camera
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        lo = glm::min(lo, glm::vec2(ndc));
+        hi = glm::max(hi, glm::vec2(ndc));
+        nearest = std::min(nearest, ndc.z);
+    }
+    if (hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f) return false;
+    const float depth = nearest * 0.5f + 0.5f;
+
+    // Screen pixels to read-back texels, like the GPU reduction (clamped into the last texel)
+    const int shift = readbackLevel + 1;
+    glm::ivec2 size = levelSizes[0];
+    int x0 = std::min(int(std::max(lo.x * 0.5f + 0.5f, 0.0f) * screenWidth) >> shift, size.x - 1);
+    int x1 = std::min(int(std::min(hi.x * 0.5f + 0.5f, 1.0f) * screenWidth) >> shift, size.x - 1);
+    int y0 = std::min(int(std::max(lo.y * 0.5f + 0.5f, 0.0f) * screenHeight) >> shift, size.y - 1);
+    int y1 = std::min(int(std::min(hi.y * 0.5f + 0.5f, 1.0f) * screenHeight) >> shift, size.y - 1);
+
+    // Coarsest level where the rectangle spans at most 2x2 texels
+    size_t level = 0;
+    while ((x1 - x0 > 1 || y1 - y0 > 1) && level + 1 < levels.size()) {
+        level++;
+        size = levelSizes[level];
+        x0 = std::min(x0 >> 1, size.x - 1);
+        x1 = std::min(x1 >> 1, size.x - 1);
+        y0 = std::min(y0 >> 1, size.y - 1);
+        y1 = std::min(y1 >> 1, size.y - 1);
+    }
+
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x)
+            if (depth <= levels[level][size_t(y) * size.x + x]) return false;
+    return true;
+}
+
+void HiZOcclusion::cull(const AabbSoA& boxes, std::vector<int>& visible, CullStats& stats) const {
+    stats.occluded = 0;
+    if (!valid) return;
+
+    size_t kept = 0;
+    for (size_t k = 0; k < visible.size(); ++k) {
+        int i = visible[k];
+        glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+        glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+        if (occluded(center, extent)) stats.occluded++;
+        else visible[kept++] = i;
+    }
+    visible.resize(kept);
+    stats.drawn -= stats.occluded;
+}
+
+void HiZOcclusion::cleanup() {
+    for (int i = 0; i < READBACK_FRAMES; ++i) {
+        if (readbacks[i].fence) glDeleteSync(readbacks[i].fence);
+        readbacks[i].fence = 0;
+        glDeleteBuffers(1, &readbacks[i].bufferID);
+    }
+    glDeleteTextures(1, &depthTextureID);
+    glDeleteTextures(1, &pyramidTextureID);
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteVertexArrays(1, &vertexArrayID);
+    ReleaseShaderProgram(programID);
+    levels.clear();
+    levelSizes.clear();
+    valid = false;
+}
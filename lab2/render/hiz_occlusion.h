@@ -0,0 +1,69 @@
+#ifndef _HIZ_OCCLUSION_H_
+#define _HIZ_OCCLUSION_H_
+
+#include "culling.h"
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Occlusion culling against an earlier frame's depth. At the end of a frame the depth
+// buffer is copied and reduced on the GPU to a hierarchical-Z pyramid (each texel the
+// farthest depth of the 2x2 below it). One coarse level is read back through a pixel
+// buffer without stalling; once it has arrived (normally the next frame) the CPU builds
+// the remaining levels and tests each box's screen rectangle against them.
+//
+// Boxes are projected with the matrix that frame was drawn with, so something that came
+// into view since is kept (it lands outside that screen) but something uncovered since
+// can stay hidden for the frame or two of latency.
+struct HiZOcclusion {
+    static const int READBACK_FRAMES = 3;   // readbacks in flight; the newest finished one is used
+    int readbackMaxWidth = 128;             // coarsest pyramid level the GPU produces and reads back
+
+    void initialize();
+
+    // Copies the depth of the bound read framebuffer (`width` x `height`, drawn with
+    // `viewProj`), builds the pyramid and starts its readback.
+    void capture(int width, int height, const glm::mat4& viewProj);
+
+    // Takes the newest readback that has finished, if any; call before cull()
+    void update();
+
+    // Removes the entries of `visible` whose box is behind the pyramid everywhere it
+    // covers; they are counted in stats.occluded and taken out of stats.drawn.
+    // Without a finished readback nothing is removed.
+    void cull(const AabbSoA& boxes, std::vector<int>& visible, CullStats& stats) const;
+
+    void cleanup();
+
+private:
+    struct Readback {
+        GLuint bufferID = 0;
+        GLsync fence = 0;
+        int width = 0, height = 0;
+        glm::mat4 viewProj;
+    };
+
+    int screenWidth = 0, screenHeight = 0;
+    int readbackLevel = 0;                  // GPU level that is read back
+    GLuint depthTextureID = 0;
+    GLuint pyramidTextureID = 0;            // R32F, levels 0..readbackLevel (level 0 = half the screen)
+    GLuint framebufferID = 0;
+    GLuint vertexArrayID = 0;               // empty; the reduce pass draws a full-screen triangle
+    GLuint programID = 0;
+
+    Readback readbacks[READBACK_FRAMES];
+    int frame = 0;
+
+    // CPU pyramid from the latest readback: levels[0] is the read-back level
+    std::vector<std::vector<float> > levels;
+    std::vector<glm::ivec2> levelSizes;
+    glm::mat4 levelsViewProj;
+    bool valid = false;
+
+    void allocate(int width, int height);
+    void buildLevels();
+    bool occluded(const glm::vec3& center, const glm::vec3& extent) const;
+};
+
+#endif
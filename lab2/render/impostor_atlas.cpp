@@ -0,0 +1,83 @@
+#include "impostor_atlas.h"
+#include "shader.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <iostream>
+
+void ImpostorAtlas::bake(GLuint boxVertexArray, GLsizei indexCount, GLuint facadeArray, int layerCount) {
+    cleanup();
+    rows = layerCount;
+    if (rows <= 0) return;
+
+    const int width = VIEWS * cellWidth;
+    const int height = rows * cellHeight;
+
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenRenderbuffers(1, &depthBufferID);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBufferID);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &framebufferID);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferID);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureID, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBufferID);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Impostor atlas framebuffer is incomplete" << std::endl;
+    }
+
+    programID = LoadShadersFromFile("lab2/impostor_bake.vert", "lab2/impostor_bake.frag");
+    glUseProgram(programID);
+    glUniform1i(glGetUniformLocation(programID, "textureSampler"), 0);
+    GLint viewProjID = glGetUniformLocation(programID, "viewProj");
+    GLint layerID = glGetUniformLocation(programID, "layer");
+
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, facadeArray);
+    glBindVertexArray(boxVertexArray);
+
+    for (int view = 0; view < VIEWS; ++view) {
+        // Looking along `dir` at the middle of the box; the ortho window is exactly its silhouette
+        float angle = 6.2831853f * view / VIEWS;
+        glm::vec3 dir(std::cos(angle), 0.0f, std::sin(angle));
+        float halfWidth = std::fabs(dir.x) + std::fabs(dir.z);
+        glm::vec3 center(0.0f, 1.0f, 0.0f);
+        glm::mat4 viewProj = glm::ortho(-halfWidth, halfWidth, -1.0f, 1.0f, 0.0f, 8.0f) *
+                             glm::lookAt(center - dir * 4.0f, center, glm::vec3(0.0f, 1.0f, 0.0f));
+        glUniformMatrix4fv(viewProjID, 1, GL_FALSE, &viewProj[0][0]);
+
+        for (int row = 0; row < rows; ++row) {
+            glViewport(view * cellWidth, row * cellHeight, cellWidth, cellHeight);
+            glUniform1f(layerID, float(row));
+            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void*)0);
+        }
+    }
+
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void ImpostorAtlas::cleanup() {
+    glDeleteFramebuffers(1, &framebufferID);
+    glDeleteRenderbuffers(1, &depthBufferID);
+    glDeleteTextures(1, &textureID);
+    if (programID) ReleaseShaderProgram(programID);
+    framebufferID = depthBufferID = textureID = programID = 0;
+    rows = 0;
+}
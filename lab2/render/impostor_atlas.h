@@ -0,0 +1,35 @@
+#ifndef _IMPOSTOR_ATLAS_H_
+#define _IMPOSTOR_ATLAS_H_
+
+#include <glad/gl.h>
+
+// Pre-rendered views of the building box for far-away impostors: one row per facade
+// layer, one column per horizontal view direction (column k looks along the yaw angle
+// 2*pi*k / VIEWS). Each cell is an orthographic render of the box's facade colour that
+// fills the cell exactly, with alpha 0 around it. Lighting is left to draw time.
+//
+// impostor.vert picks the cell from the direction the camera sees a building from and
+// stretches it over a camera-facing quad of the building's size, split where its two
+// visible faces meet so each side is lit with its own normal.
+struct ImpostorAtlas {
+    static const int VIEWS = 16;
+
+    int cellWidth = 64;
+    int cellHeight = 128;
+    int rows = 0;
+    GLuint textureID = 0;
+
+    // Renders every cell. `boxVertexArray` draws the box (x,z in [-1, 1], y in [0, 2]) with
+    // `indexCount` indices; rows are layers 0..layerCount-1 of `facadeArray`. Calling it
+    // again (e.g. after new facades) rebuilds the atlas.
+    void bake(GLuint boxVertexArray, GLsizei indexCount, GLuint facadeArray, int layerCount);
+
+    void cleanup();
+
+private:
+    GLuint programID = 0;
+    GLuint framebufferID = 0;
+    GLuint depthBufferID = 0;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#include "render_queue.h"
+
+#include <algorithm>
+
+uint64_t MakeSortKey(RenderLayer layer, unsigned program, unsigned texture, float depth01) {
+    float d = std::min(std::max(depth01, 0.0f), 1.0f);
+    uint64_t depth = uint64_t(d * float(0xffffff));
+    return (uint64_t(layer & 0xf) << 60) |
+           (uint64_t(program & 0xfff) << 48) |
+           (uint64_t(texture & 0xffff) << 32) |
+           (depth << 8);
+}
+
+void RenderQueue::sort() {
+    const size_t n = packets.size();
+    if (n < 2) return;
+
+    // All eight histograms in one sweep
+    size_t counts[8][256] = {};
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = packets[i].key;
+        for (int b = 0; b < 8; ++b) counts[b][(key >> (8 * b)) & 0xff]++;
+    }
+
+    scratch.resize(n);
+    DrawPacket* src = &packets[0];
+    DrawPacket* dst = &scratch[0];
+    for (int b = 0; b < 8; ++b) {
+        size_t* count = counts[b];
+        if (count[(src[0].key >> (8 * b)) & 0xff] == n) continue;
+
+        size_t offset = 0;
+        for (int v = 0; v < 256; ++v) {
+            size_t c = count[v];
+            count[v] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst[count[(src[i].key >> (8 * b)) & 0xff]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    if (src != &packets[0]) packets.swap(scratch);
+}
@@ -0,0 +1,48 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Coarsest ordering: everything in one layer is drawn before the next
+enum RenderLayer {
+    LAYER_OPAQUE = 0,
+    LAYER_SKY = 1,      // after all opaque geometry; sits at the far plane and draws with GL_LEQUAL
+};
+
+// Key layout, high to low: layer (4) | program (12) | texture (16) | depth (24) | unused (8).
+// Ascending order groups draws by layer, then by shader and texture so state changes only
+// happen between groups, then front to back inside a group for early-Z rejection.
+// GL names are truncated to their field, so two names can share a value: the key only
+// orders draws, and which program or texture to bind must come from the draw itself.
+uint64_t MakeSortKey(RenderLayer layer, unsigned program, unsigned texture, float depth01);
+
+inline RenderLayer SortKeyLayer(uint64_t key) { return RenderLayer(key >> 60); }
+
+// `item` is whatever the submitter indexes its draws with (a building index, ...)
+struct DrawPacket {
+    uint64_t key;
+    int item;
+};
+
+// Per-frame list of draws, radix sorted on the key before submission
+struct RenderQueue {
+    std::vector<DrawPacket> packets;
+
+    void clear() { packets.clear(); }
+    void reserve(size_t count) { packets.reserve(count); scratch.reserve(count); }
+    void push(uint64_t key, int item) { DrawPacket p = {key, item}; packets.push_back(p); }
+
+    // Stable LSD radix sort, one byte per pass. Bytes that are the same in every key
+    // (e.g. program and texture when everything is one instanced draw) are skipped.
+    void sort();
+
+    size_t size() const { return packets.size(); }
+    const DrawPacket& operator[](size_t i) const { return packets[i]; }
+
+private:
+    std::vector<DrawPacket> scratch;
+};
+
+#endif
@@ -5,8 +5,58 @@
 #include <fstream>
 #include <sstream> 
 #include <vector>
+#include <map>
+#include <set>
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path)
+// Shared program registry, keyed by source paths + canonical define block
+struct ShaderProgramEntry {
+	GLuint programID;
+	int refCount;
+};
+static std::map<std::string, ShaderProgramEntry> programRegistry;
+
+// "B;A=2" -> "#define A 2\n#define B\n" (sorted so the key does not depend on order)
+static std::string BuildDefineBlock(const char *defines)
+{
+	std::set<std::string> names;
+	std::string list = defines ? defines : "";
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(';', start);
+		if (end == std::string::npos) end = list.size();
+		std::string item = list.substr(start, end - start);
+		size_t first = item.find_first_not_of(" \t");
+		size_t last = item.find_last_not_of(" \t");
+		if (first != std::string::npos) names.insert(item.substr(first, last - first + 1));
+		start = end + 1;
+	}
+
+	std::string block;
+	for (const std::string &name : names) {
+		size_t eq = name.find('=');
+		if (eq == std::string::npos) block += "#define " + name + "\n";
+		else block += "#define " + name.substr(0, eq) + " " + name.substr(eq + 1) + "\n";
+	}
+	return block;
+}
+
+// Defines must follow the #version line; #line keeps compiler messages on the file's numbering
+static void InjectDefines(std::string &code, const std::string &defineBlock)
+{
+	if (defineBlock.empty()) return;
+	size_t pos = 0;
+	if (code.compare(0, 8, "#version") == 0) {
+		pos = code.find('\n');
+		if (pos == std::string::npos) {
+			code += '\n';
+			pos = code.size() - 1;
+		}
+		pos++;
+	}
+	code.insert(pos, defineBlock + "#line " + std::to_string(pos == 0 ? 1 : 2) + "\n");
+}
+
+static GLuint CompileShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const std::string &defineBlock)
 {
 	// Create the shaders
 	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
@@ -44,6 +94,9 @@ GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_fi
 		return 0;
 	}
 
+	InjectDefines(VertexShaderCode, defineBlock);
+	InjectDefines(FragmentShaderCode, defineBlock);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
@@ -116,6 +169,42 @@ GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_fi
 	return ProgramID;
 }
 
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const char *defines)
+{
+	std::string defineBlock = BuildDefineBlock(defines);
+	std::string key = std::string(vertex_file_path) + "|" + fragment_file_path + "|" + defineBlock;
+
+	std::map<std::string, ShaderProgramEntry>::iterator it = programRegistry.find(key);
+	if (it != programRegistry.end()) {
+		it->second.refCount++;
+		return it->second.programID;
+	}
+
+	GLuint ProgramID = CompileShadersFromFile(vertex_file_path, fragment_file_path, defineBlock);
+	if (ProgramID == 0) return 0;
+
+	ShaderProgramEntry entry = { ProgramID, 1 };
+	programRegistry[key] = entry;
+	return ProgramID;
+}
+
+void ReleaseShaderProgram(GLuint programID)
+{
+	if (programID == 0) return;
+
+	for (std::map<std::string, ShaderProgramEntry>::iterator it = programRegistry.begin(); it != programRegistry.end(); ++it) {
+		if (it->second.programID != programID) continue;
+		if (--it->second.refCount == 0) {
+			glDeleteProgram(programID);
+			programRegistry.erase(it);
+		}
+		return;
+	}
+
+	// Not from the registry (e.g. LoadShadersFromString), so it is ours alone
+	glDeleteProgram(programID);
+}
+
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode)
 {
 	// Create the shaders
@@ -4,7 +4,13 @@
 #include <glad/gl.h>
 #include <string>
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path);
+// Programs loaded from files are shared: asking again for the same vertex/fragment
+// pair and define set returns the already linked program and bumps its reference count.
+// `defines` is a ';'-separated list such as "PCF_TAPS=16;USE_FOG", injected after #version.
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const char *defines = NULL);
+
+// Drops one reference taken by LoadShadersFromFile; the program is deleted with the last one.
+void ReleaseShaderProgram(GLuint programID);
 
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode);
 
@@ -0,0 +1,119 @@
+#include "sky_cubemap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// One face of the unit cube as it was laid out on the cross: corner p0 and the corners
+// p1, p3 next to it, with their UVs. UVs are affine over the face.
+struct CrossFace {
+    float p0[3], p1[3], p3[3];
+    float uv0[2], uv1[2], uv3[2];
+};
+
+// In GL cube map face order
+const CrossFace CROSS_FACES[6] = {
+    // +X (right)
+    {{ 1,-1, 1}, { 1,-1,-1}, { 1, 1, 1}, {0.50f, 0.6667f}, {0.75f, 0.6667f}, {0.50f, 0.3333f}},
+    // -X (left)
+    {{-1,-1,-1}, {-1,-1, 1}, {-1, 1,-1}, {0.00f, 0.6667f}, {0.25f, 0.6667f}, {0.00f, 0.3333f}},
+    // +Y (top)
+    {{-1, 1, 1}, { 1, 1, 1}, {-1, 1,-1}, {0.25f, 1.0000f}, {0.50f, 1.0000f}, {0.25f, 0.6667f}},
+    // -Y (bottom)
+    {{-1,-1,-1}, { 1,-1,-1}, {-1,-1, 1}, {0.25f, 0.3333f}, {0.50f, 0.3333f}, {0.25f, 0.0000f}},
+    // +Z (front)
+    {{-1,-1, 1}, { 1,-1, 1}, {-1, 1, 1}, {0.25f, 0.6667f}, {0.50f, 0.6667f}, {0.25f, 0.3333f}},
+    // -Z (back)
+    {{ 1,-1,-1}, {-1,-1,-1}, { 1, 1,-1}, {0.75f, 0.6667f}, {1.00f, 0.6667f}, {0.75f, 0.3333f}},
+};
+
+// Point on face `face` of the unit cube for cube map coordinates s, t in [0, 1]
+void FaceDirection(int face, float s, float t, float d[3]) {
+    float sc = 2.0f * s - 1.0f;
+    float tc = 2.0f * t - 1.0f;
+    switch (face) {
+    case 0: d[0] =  1.0f; d[1] = -tc;   d[2] = -sc;   break;
+    case 1: d[0] = -1.0f; d[1] = -tc;   d[2] =  sc;   break;
+    case 2: d[0] =  sc;   d[1] =  1.0f; d[2] =  tc;   break;
+    case 3: d[0] =  sc;   d[1] = -1.0f; d[2] = -tc;   break;
+    case 4: d[0] =  sc;   d[1] = -tc;   d[2] =  1.0f; break;
+    default: d[0] = -sc;  d[1] = -tc;   d[2] = -1.0f; break;
+    }
+}
+
+// Bilinear RGB8 fetch at texture coordinates u, v (v = 0 is the first row), clamped to the image
+void SampleBilinear(const DecodedImage& image, float u, float v, unsigned char* out) {
+    const unsigned char* pixels = image.level(0);
+    float x = std::min(std::max(u * image.width - 0.5f, 0.0f), (float)(image.width - 1));
+    float y = std::min(std::max(v * image.height - 0.5f, 0.0f), (float)(image.height - 1));
+    int x0 = (int)x, y0 = (int)y;
+    int x1 = std::min(x0 + 1, image.width - 1);
+    int y1 = std::min(y0 + 1, image.height - 1);
+    float fx = x - x0, fy = y - y0;
+
+    for (int c = 0; c < 3; ++c) {
+        float top = pixels[(y0 * image.width + x0) * 3 + c] * (1.0f - fx) + pixels[(y0 * image.width + x1) * 3 + c] * fx;
+        float bottom = pixels[(y1 * image.width + x0) * 3 + c] * (1.0f - fx) + pixels[(y1 * image.width + x1) * 3 + c] * fx;
+        out[c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+    }
+}
+
+} // namespace
+
+int CrossFaceSize(const DecodedImage& cross) {
+    return std::min(cross.width / 4, cross.height / 3);
+}
+
+void SplitCrossImage(const DecodedImage& cross, int size, std::vector<unsigned char> faces[6]) {
+    for (int face = 0; face < 6; ++face) {
+        const CrossFace& f = CROSS_FACES[face];
+        faces[face].resize((size_t)size * size * 3);
+
+        for (int j = 0; j < size; ++j) {
+            for (int i = 0; i < size; ++i) {
+                float d[3];
+                FaceDirection(face, (i + 0.5f) / size, (j + 0.5f) / size, d);
+
+                // Position along the two cube edges (each 2 long), then the affine UV
+                float a = 0.0f, b = 0.0f;
+                for (int k = 0; k < 3; ++k) {
+                    a += (d[k] - f.p0[k]) * (f.p1[k] - f.p0[k]) * 0.25f;
+                    b += (d[k] - f.p0[k]) * (f.p3[k] - f.p0[k]) * 0.25f;
+                }
+                float u = f.uv0[0] + a * (f.uv1[0] - f.uv0[0]) + b * (f.uv3[0] - f.uv0[0]);
+                float v = f.uv0[1] + a * (f.uv1[1] - f.uv0[1]) + b * (f.uv3[1] - f.uv0[1]);
+
+                SampleBilinear(cross, u, v, &faces[face][((size_t)j * size + i) * 3]);
+            }
+        }
+    }
+}
+
+GLuint CreateCrossCubemap(const DecodedImage& cross) {
+    int size = CrossFaceSize(cross);
+    if (size <= 0) return 0;
+
+    std::vector<unsigned char> faces[6];
+    SplitCrossImage(cross, size, faces);
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, size, size, 0,
+                     GL_RGB, GL_UNSIGNED_BYTE, faces[face].data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    // Filter across face edges instead of clamping at each face
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    return textureID;
+}
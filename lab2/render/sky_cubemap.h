@@ -0,0 +1,22 @@
+#ifndef _SKY_CUBEMAP_H_
+#define _SKY_CUBEMAP_H_
+
+#include "texture_bake.h"
+
+#include <glad/gl.h>
+#include <vector>
+
+// Edge length of the cube faces cut from a 4x3 cross image
+int CrossFaceSize(const DecodedImage& cross);
+
+// Resamples a sky cross image (loaded bottom-up, as the old skybox cube used it) into the
+// six faces of a cube map, in GL face order (+X, -X, +Y, -Y, +Z, -Z), `size` x `size`
+// RGB8 each. Every face texel looks up the direction it stands for in the cross, so the
+// cube map shows exactly what the old textured cube did.
+void SplitCrossImage(const DecodedImage& cross, int size, std::vector<unsigned char> faces[6]);
+
+// SplitCrossImage() uploaded as a GL_TEXTURE_CUBE_MAP (linear, clamped, seamless filtering
+// switched on). Returns 0 for an empty image.
+GLuint CreateCrossCubemap(const DecodedImage& cross);
+
+#endif
@@ -0,0 +1,165 @@
+#include "texture_bake.h"
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const char* path) {
+    close();
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data = static_cast<const unsigned char*>(p);
+            size = size_t(st.st_size);
+            mapped = true;
+        }
+    }
+    ::close(fd);
+    if (mapped) return true;
+#endif
+    // No mmap: one fread of the whole file
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (length > 0) {
+        buffer.resize(size_t(length));
+        if (fread(&buffer[0], 1, buffer.size(), f) != buffer.size()) buffer.clear();
+    }
+    fclose(f);
+    if (buffer.empty()) return false;
+    data = &buffer[0];
+    size = buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifndef _WIN32
+    if (mapped) munmap(const_cast<unsigned char*>(data), size);
+#endif
+    mapped = false;
+    buffer.clear();
+    data = NULL;
+    size = 0;
+}
+
+const unsigned char* DecodedImage::level(int l) const {
+    const unsigned char* p = mapped ? mapped : &pixels[0];
+    for (int i = 0; i < l; ++i) p += size_t(levelWidth(i)) * levelHeight(i) * 3;
+    return p;
+}
+
+int FullMipCount(int width, int height) {
+    int levels = 1;
+    while ((width >> levels) > 0 || (height >> levels) > 0) levels++;
+    return levels;
+}
+
+void DownsampleImage(const DecodedImage& src, DecodedImage& dst) {
+    const unsigned char* s = src.level(0);
+    dst.width = src.width / 2 > 0 ? src.width / 2 : 1;
+    dst.height = src.height / 2 > 0 ? src.height / 2 : 1;
+    dst.levels = 1;
+    dst.pixels.resize(size_t(dst.width) * dst.height * 3);
+    dst.mapped = NULL;
+    dst.file.reset();
+
+    for (int y = 0; y < dst.height; ++y) {
+        int y0 = 2 * y < src.height ? 2 * y : src.height - 1;
+        int y1 = 2 * y + 1 < src.height ? 2 * y + 1 : src.height - 1;
+        for (int x = 0; x < dst.width; ++x) {
+            int x0 = 2 * x < src.width ? 2 * x : src.width - 1;
+            int x1 = 2 * x + 1 < src.width ? 2 * x + 1 : src.width - 1;
+            for (int c = 0; c < 3; ++c) {
+                int sum = s[(size_t(y0) * src.width + x0) * 3 + c] + s[(size_t(y0) * src.width + x1) * 3 + c] +
+                          s[(size_t(y1) * src.width + x0) * 3 + c] + s[(size_t(y1) * src.width + x1) * 3 + c];
+                dst.pixels[(size_t(y) * dst.width + x) * 3 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+std::string BakedPathFor(const std::string& sourcePath) {
+    return sourcePath + ".texb";
+}
+
+bool WriteBakedTexture(const char* path, const DecodedImage& image, bool flipped) {
+    BakedTextureHeader header;
+    memcpy(header.magic, "TXB1", 4);
+    header.version = BAKED_TEXTURE_VERSION;
+    header.width = uint32_t(image.width);
+    header.height = uint32_t(image.height);
+    header.levels = uint32_t(FullMipCount(image.width, image.height));
+    header.format = BAKED_RGB8;
+    header.flags = flipped ? BAKED_FLIPPED : 0;
+    header.dataOffset = uint32_t(sizeof(BakedTextureHeader));
+
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    DecodedImage level, next;
+    level.width = image.width;
+    level.height = image.height;
+    level.pixels.assign(image.level(0), image.level(0) + size_t(image.width) * image.height * 3);
+    for (uint32_t l = 0; ok && l < header.levels; ++l) {
+        ok = fwrite(&level.pixels[0], 1, level.pixels.size(), f) == level.pixels.size();
+        if (l + 1 < header.levels) {
+            DownsampleImage(level, next);
+            std::swap(level, next);
+        }
+    }
+    return fclose(f) == 0 && ok;
+}
+
+bool LoadBakedTexture(const std::string& sourcePath, bool flipVertically, DecodedImage& out) {
+    const std::string bakedPath = BakedPathFor(sourcePath);
+    struct stat baked, source;
+    if (stat(bakedPath.c_str(), &baked) != 0) return false;
+    if (stat(sourcePath.c_str(), &source) == 0 && source.st_mtime > baked.st_mtime) return false;
+
+    std::shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(bakedPath.c_str()) || file->size < sizeof(BakedTextureHeader)) return false;
+
+    BakedTextureHeader header;
+    memcpy(&header, file->data, sizeof(header));
+    if (memcmp(header.magic, "TXB1", 4) != 0 || header.version != BAKED_TEXTURE_VERSION) return false;
+    if (header.format != BAKED_RGB8 || ((header.flags & BAKED_FLIPPED) != 0) != flipVertically) return false;
+
+    // Check the header before trusting it: the size bounds keep the byte count from
+    // overflowing, and the levels must be the full chain the baker writes
+    if (header.width < 1 || header.width > BAKED_MAX_SIZE) return false;
+    if (header.height < 1 || header.height > BAKED_MAX_SIZE) return false;
+    if (header.levels != uint32_t(FullMipCount(int(header.width), int(header.height)))) return false;
+
+    DecodedImage image;
+    image.width = int(header.width);
+    image.height = int(header.height);
+    image.levels = int(header.levels);
+
+    // Every level has to be inside the file
+    size_t bytes = 0;
+    for (int l = 0; l < image.levels; ++l) bytes += size_t(image.levelWidth(l)) * image.levelHeight(l) * 3;
+    if (header.dataOffset < sizeof(header) || header.dataOffset > file->size) return false;
+    if (bytes > file->size - header.dataOffset) return false;
+
+    out.width = image.width;
+    out.height = image.height;
+    out.levels = image.levels;
+    out.pixels.clear();
+    out.mapped = file->data + header.dataOffset;
+    out.file = file;
+    return true;
+}
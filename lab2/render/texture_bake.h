@@ -0,0 +1,79 @@
+#ifndef _TEXTURE_BAKE_H_
+#define _TEXTURE_BAKE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file: mmap where available, otherwise read into memory
+struct MappedFile {
+    const unsigned char* data = NULL;
+    size_t size = 0;
+
+    bool open(const char* path);
+    void close();
+    ~MappedFile() { close(); }
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+    std::vector<unsigned char> buffer;  // fallback storage when not mapped
+    bool mapped = false;
+};
+
+// RGB8 image, optionally with its mip chain. Levels are tightly packed back to back,
+// level 0 first, each half the size of the previous one (never below 1).
+// The pixels either belong to the image or stay inside a mapped baked file.
+struct DecodedImage {
+    int width = 0;
+    int height = 0;
+    int levels = 1;
+    std::vector<unsigned char> pixels;      // owned pixels (decoded images)
+    std::shared_ptr<MappedFile> file;       // keeps `mapped` alive (baked images)
+    const unsigned char* mapped = NULL;
+
+    int levelWidth(int l) const { return width >> l > 0 ? width >> l : 1; }
+    int levelHeight(int l) const { return height >> l > 0 ? height >> l : 1; }
+    const unsigned char* level(int l) const;
+};
+
+// 2x2 box filter of src level 0 into dst (owned pixels), clamping at odd edges
+void DownsampleImage(const DecodedImage& src, DecodedImage& dst);
+
+// Number of levels in a full chain down to 1x1
+int FullMipCount(int width, int height);
+
+// ---------- Baked texture container (.texb) ----------
+// A fixed header followed by every mip level, raw RGB8, exactly as the GL upload
+// wants them, so loading is a map plus one glTexImage per level.
+static const uint32_t BAKED_TEXTURE_VERSION = 1;
+static const uint32_t BAKED_MAX_SIZE = 16384;       // larger headers are rejected as corrupt
+enum BakedFormat { BAKED_RGB8 = 0 };
+
+struct BakedTextureHeader {
+    char magic[4];          // "TXB1"
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;        // always the full chain
+    uint32_t format;        // BakedFormat
+    uint32_t flags;         // BAKED_FLIPPED
+    uint32_t dataOffset;    // from the start of the file
+};
+static const uint32_t BAKED_FLIPPED = 1;   // rows stored bottom-up (what the sky wants)
+
+// Baked files sit next to their source: "lab2/skin.png" -> "lab2/skin.png.texb"
+std::string BakedPathFor(const std::string& sourcePath);
+
+// Builds the full mip chain of `image` (level 0 is used) and writes it to `path`.
+bool WriteBakedTexture(const char* path, const DecodedImage& image, bool flipped);
+
+// Maps the baked file of `sourcePath` into `out`. Fails (so the caller decodes the source)
+// if there is none, it is older than the source, or it was baked with the other row order.
+bool LoadBakedTexture(const std::string& sourcePath, bool flipVertically, DecodedImage& out);
+
+#endif
@@ -0,0 +1,158 @@
+#include "texture_cache.h"
+
+#include <stb/stb_image.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+static std::string EntryKey(const std::string& path, bool flipVertically) {
+    return path + (flipVertically ? "|flip" : "|noflip");
+}
+
+// Runs on a worker: never touches GL, and flips by hand because stb's flip flag is global
+static bool DecodeImage(const std::string& path, bool flipVertically, DecodedImage& out) {
+    if (LoadBakedTexture(path, flipVertically, out)) return true;
+
+    int w, h, channels;
+    uint8_t* img = stbi_load(path.c_str(), &w, &h, &channels, 3);
+    if (!img) return false;
+
+    const size_t rowBytes = size_t(w) * 3;
+    out.width = w;
+    out.height = h;
+    out.pixels.resize(rowBytes * h);
+    for (int y = 0; y < h; ++y) {
+        int src = flipVertically ? (h - 1 - y) : y;
+        memcpy(&out.pixels[rowBytes * y], img + rowBytes * src, rowBytes);
+    }
+
+    stbi_image_free(img);
+    return true;
+}
+
+void TextureCache::start(int workerCount) {
+    if (workerCount <= 0) workerCount = int(std::thread::hardware_concurrency());
+    if (workerCount <= 0) workerCount = 2;
+
+    stopping = false;
+    for (int i = 0; i < workerCount; ++i) {
+        workers.push_back(std::thread(&TextureCache::workerLoop, this));
+    }
+}
+
+void TextureCache::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queued.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        Entry* e = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        DecodedImage img;
+        bool ok = DecodeImage(e->path, e->flip, img);
+        lock.lock();
+
+        e->image = std::move(img);
+        e->state = ok ? DECODE_DONE : DECODE_FAILED;
+        decoded.notify_all();
+    }
+}
+
+// Caller holds `mutex`
+TextureCache::Entry& TextureCache::request(const std::string& path, bool flipVertically) {
+    std::string key = EntryKey(path, flipVertically);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        hits++;
+        return it->second;
+    }
+
+    misses++;
+    Entry& e = entries[key];
+    e.path = path;
+    e.flip = flipVertically;
+    queue.push_back(&e);
+    queued.notify_one();
+    return e;
+}
+
+void TextureCache::prefetch(const char* path, bool flipVertically) {
+    std::lock_guard<std::mutex> lock(mutex);
+    request(path, flipVertically);
+}
+
+TextureCache::Entry& TextureCache::wait(const std::string& path, bool flipVertically) {
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry& e = request(path, flipVertically);
+
+    if (workers.empty() && e.state == DECODE_QUEUED) {
+        // No pool running: decode inline on the caller's thread
+        queue.erase(std::remove(queue.begin(), queue.end(), &e), queue.end());
+        e.state = DecodeImage(e.path, e.flip, e.image) ? DECODE_DONE : DECODE_FAILED;
+    }
+
+    decoded.wait(lock, [&e] { return e.state != DECODE_QUEUED; });
+    return e;
+}
+
+const DecodedImage* TextureCache::image(const char* path, bool flipVertically) {
+    Entry& e = wait(path, flipVertically);
+    return e.state == DECODE_DONE ? &e.image : NULL;
+}
+
+void TextureCache::release(const char* path, bool flipVertically) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, Entry>::iterator it = entries.find(EntryKey(path, flipVertically));
+    // A queued entry is still referenced by the queue or a worker
+    if (it != entries.end() && it->second.state != DECODE_QUEUED) entries.erase(it);
+}
+
+void TextureCache::resize(const DecodedImage& src, int width, int height, DecodedImage& dst) {
+    dst.width = width;
+    dst.height = height;
+    dst.levels = 1;
+    dst.pixels.resize(size_t(width) * height * 3);
+    dst.mapped = NULL;
+    dst.file.reset();
+    const unsigned char* s = src.level(0);
+
+    for (int y = 0; y < height; ++y) {
+        float sy = std::max(0.0f, (y + 0.5f) * src.height / height - 0.5f);
+        int y0 = std::min(int(sy), src.height - 1);
+        int y1 = std::min(y0 + 1, src.height - 1);
+        float fy = sy - y0;
+
+        for (int x = 0; x < width; ++x) {
+            float sx = std::max(0.0f, (x + 0.5f) * src.width / width - 0.5f);
+            int x0 = std::min(int(sx), src.width - 1);
+            int x1 = std::min(x0 + 1, src.width - 1);
+            float fx = sx - x0;
+
+            for (int c = 0; c < 3; ++c) {
+                float a = s[(size_t(y0) * src.width + x0) * 3 + c];
+                float b = s[(size_t(y0) * src.width + x1) * 3 + c];
+                float d = s[(size_t(y1) * src.width + x0) * 3 + c];
+                float e = s[(size_t(y1) * src.width + x1) * 3 + c];
+                float top = a + (b - a) * fx;
+                float bottom = d + (e - d) * fx;
+                dst.pixels[(size_t(y) * width + x) * 3 + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    }
+}
+
+void TextureCache::cleanup() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    queued.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    workers.clear();
+
+    entries.clear();
+}
@@ -0,0 +1,64 @@
+#ifndef _TEXTURE_CACHE_H_
+#define _TEXTURE_CACHE_H_
+
+#include "texture_bake.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// Path-keyed image cache. Images are decoded once on a pool of worker threads; the
+// callers turn them into GL textures themselves (FacadeMaterials, the sky cube map).
+// An up-to-date baked file next to the image (see texture_bake.h, tools/texbake.cpp)
+// is mapped instead of decoding; FacadeMaterials uploads its mip levels as they are.
+struct TextureCache {
+    // Starts the decode workers (0 = one per hardware thread).
+    void start(int workerCount = 0);
+
+    // Queues a decode without blocking; image() later picks it up.
+    void prefetch(const char* path, bool flipVertically = false);
+
+    // Waits for the decode and returns the CPU image, or NULL on failure.
+    const DecodedImage* image(const char* path, bool flipVertically = false);
+
+    // Frees the CPU image of `path` (its pixels or its mapped baked file) once it has been
+    // uploaded. Asking for it again decodes it again.
+    void release(const char* path, bool flipVertically = false);
+
+    // Joins the workers and drops every image.
+    void cleanup();
+
+    // Bilinear resample of an RGB8 image (CPU side, used to pack array layers, see FacadeMaterials).
+    static void resize(const DecodedImage& src, int width, int height, DecodedImage& dst);
+
+    int hits = 0;       // prefetch()/image() found the path already requested
+    int misses = 0;     // prefetch()/image() had to queue a decode
+
+private:
+    enum DecodeState { DECODE_QUEUED, DECODE_DONE, DECODE_FAILED };
+
+    struct Entry {
+        std::string path;
+        bool flip = false;
+        DecodeState state = DECODE_QUEUED;
+        DecodedImage image;
+    };
+
+    std::map<std::string, Entry> entries;       // keyed by path + flip
+    std::deque<Entry*> queue;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable decoded;
+    bool stopping = false;
+
+    Entry& request(const std::string& path, bool flipVertically);
+    Entry& wait(const std::string& path, bool flipVertically);
+    void workerLoop();
+};
+
+#endif
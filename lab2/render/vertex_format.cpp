@@ -0,0 +1,27 @@
+#include "vertex_format.h"
+
+VertexFormat& VertexFormat::add(GLuint location, GLint components, GLenum type, size_t offset, GLboolean normalized) {
+    Attribute a = {location, components, type, normalized, false, offset};
+    attributes.push_back(a);
+    return *this;
+}
+
+VertexFormat& VertexFormat::addInteger(GLuint location, GLint components, GLenum type, size_t offset) {
+    Attribute a = {location, components, type, GL_FALSE, true, offset};
+    attributes.push_back(a);
+    return *this;
+}
+
+void VertexFormat::apply(GLuint buffer) const {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        const Attribute& a = attributes[i];
+        glEnableVertexAttribArray(a.location);
+        if (a.integer) {
+            glVertexAttribIPointer(a.location, a.components, a.type, stride, (void*)a.offset);
+        } else {
+            glVertexAttribPointer(a.location, a.components, a.type, a.normalized, stride, (void*)a.offset);
+        }
+        glVertexAttribDivisor(a.location, divisor);
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef _VERTEX_FORMAT_H_
+#define _VERTEX_FORMAT_H_
+
+#include <glad/gl.h>
+#include <cstddef>
+#include <vector>
+
+// Layout of one vertex buffer: every attribute the shaders read from it, with its
+// location and byte offset inside a stride-sized record (interleaved, or a single stream).
+struct VertexFormat {
+    struct Attribute {
+        GLuint location;
+        GLint components;
+        GLenum type;
+        GLboolean normalized;
+        bool integer;           // read as int/uint in the shader (glVertexAttribIPointer)
+        size_t offset;
+    };
+
+    GLsizei stride = 0;
+    GLuint divisor = 0;         // 0 = per vertex, 1 = per instance
+    std::vector<Attribute> attributes;
+
+    explicit VertexFormat(GLsizei stride, GLuint divisor = 0) : stride(stride), divisor(divisor) {}
+
+    VertexFormat& add(GLuint location, GLint components, GLenum type, size_t offset, GLboolean normalized = GL_FALSE);
+    VertexFormat& addInteger(GLuint location, GLint components, GLenum type, size_t offset);
+
+    // Records the layout for `buffer` into the currently bound VAO. Call once at set-up;
+    // afterwards binding the VAO is all a draw needs.
+    void apply(GLuint buffer) const;
+};
+
+#endif
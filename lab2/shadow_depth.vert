@@ -1,9 +1,47 @@
 #version 330 core
 layout(location = 0) in vec3 vertexPosition;
 
-uniform mat4 lightSpaceMatrix;
+// Per-frame data, filled once per frame (see FrameUniforms in final.cpp)
+layout(std140) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 cameraPos;
+    vec4 cameraForward;
+    vec4 lightPosition;
+    vec4 lightDirection;
+    vec4 lightIntensity;
+    vec4 fogColorDensity;
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    vec4 cascadeBias;
+    vec4 shadowParams;
+};
+
+#ifdef CAMERA_DEPTH
+// Depth pre-pass: must land on exactly the depths lit_box.vert produces (GL_EQUAL)
+invariant gl_Position;
+
+vec4 ToClip(vec4 wp) { return viewProj * wp; }
+#else
+// Layer being rendered: selects the light matrix
+uniform int cascade;
+
+vec4 ToClip(vec4 wp) { return cascadeMatrices[cascade] * wp; }
+#endif
+
+#ifdef INSTANCED
+layout(location = 4) in int instanceIndex;      // per instance, see BuildingBatch
+uniform samplerBuffer instancePool;
+
+void main() {
+    int base = instanceIndex * 5;
+    mat4 instanceModel = mat4(texelFetch(instancePool, base), texelFetch(instancePool, base + 1),
+                              texelFetch(instancePool, base + 2), texelFetch(instancePool, base + 3));
+    gl_Position = ToClip(instanceModel * vec4(vertexPosition, 1.0));
+}
+#else
 uniform mat4 Model;
 
 void main() {
-    gl_Position = lightSpaceMatrix * Model * vec4(vertexPosition, 1.0);
+    gl_Position = ToClip(Model * vec4(vertexPosition, 1.0));
 }
+#endif
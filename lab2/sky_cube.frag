@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+in vec3 viewRay;
+uniform samplerCube skybox;
+
+void main()
+{
+    FragColor = texture(skybox, normalize(viewRay));
+}
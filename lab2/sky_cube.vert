@@ -0,0 +1,18 @@
+#version 330 core
+
+// One triangle covering the whole screen, generated from gl_VertexID (no vertex buffers)
+out vec3 viewRay;
+
+uniform mat4 invViewProj;   // inverse(projection * view without translation)
+
+void main()
+{
+    vec2 ndc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+
+    // Far-plane point under this corner, relative to the camera
+    vec4 farPoint = invViewProj * vec4(ndc, 1.0, 1.0);
+    viewRay = farPoint.xyz / farPoint.w;
+
+    // Depth 1: behind everything, drawn with GL_LEQUAL
+    gl_Position = vec4(ndc, 1.0, 1.0);
+}
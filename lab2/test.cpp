@@ -338,7 +338,7 @@ struct Building {
 		glDeleteBuffers(1, &colorBufferID);
 		glDeleteBuffers(1, &indexBufferID);
 		glDeleteVertexArrays(1, &vertexArrayID);
-		glDeleteProgram(programID);
+		ReleaseShaderProgram(programID);
 	}
 };
 
@@ -450,7 +450,7 @@ struct Skybox {
        glDeleteBuffers(1, &indexBufferID);
        glDeleteTextures(1, &textureID);
        glDeleteVertexArrays(1, &vertexArrayID);
-       glDeleteProgram(programID);
+       ReleaseShaderProgram(programID);
     }
 };
 
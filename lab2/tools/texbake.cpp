@@ -0,0 +1,65 @@
+// texbake: converts images into baked textures (.texb, see render/texture_bake.h) so the
+// game maps them at start-up instead of decoding and mipmapping.
+//
+//   texbake [--flip] image...
+//
+// Each image is written next to itself as <image>.texb. --flip stores the images after it
+// bottom-up, for textures loaded flipped (the sky). A baked file older than its image is ignored.
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+#include "render/texture_bake.h"
+
+#include <cstring>
+#include <iostream>
+
+static bool DecodeSource(const char* path, bool flip, DecodedImage& out) {
+    int w, h, channels;
+    unsigned char* img = stbi_load(path, &w, &h, &channels, 3);
+    if (!img) return false;
+
+    const size_t rowBytes = size_t(w) * 3;
+    out.width = w;
+    out.height = h;
+    out.pixels.resize(rowBytes * h);
+    for (int y = 0; y < h; ++y) {
+        memcpy(&out.pixels[rowBytes * y], img + rowBytes * (flip ? h - 1 - y : y), rowBytes);
+    }
+    stbi_image_free(img);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    bool flip = false;
+    int failures = 0, baked = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--flip") == 0) {
+            flip = true;
+            continue;
+        }
+
+        DecodedImage image;
+        if (!DecodeSource(argv[i], flip, image)) {
+            std::cerr << "texbake: cannot decode " << argv[i] << std::endl;
+            failures++;
+            continue;
+        }
+
+        std::string out = BakedPathFor(argv[i]);
+        if (!WriteBakedTexture(out.c_str(), image, flip)) {
+            std::cerr << "texbake: cannot write " << out << std::endl;
+            failures++;
+            continue;
+        }
+        std::cout << argv[i] << " -> " << out << " (" << image.width << "x" << image.height << ", "
+                  << FullMipCount(image.width, image.height) << " levels)" << std::endl;
+        baked++;
+    }
+
+    if (baked + failures == 0) {
+        std::cerr << "usage: texbake [--flip] image..." << std::endl;
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
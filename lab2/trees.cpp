@@ -14,8 +14,10 @@
 #include <render/shader.h>
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <ctype.h>
 #define _USE_MATH_DEFINES
 #include <math.h>
 
@@ -47,6 +49,9 @@ static glm::vec3 lightPosition(-275.0f, 500.0f, 800.0f);
 // Animation State
 static bool playAnimation = true;
 static float playbackSpeed = 2.0f;
+static bool crossfadeToNextClip = false;
+static bool overlayLayerOn = true;
+static const float overlayLayerWeight = 0.5f;
 
 // ----------------------------------------------------------------------------
 // SKYBOX STRUCT
@@ -165,7 +170,7 @@ struct Skybox {
        glDeleteBuffers(1, &indexBufferID);
        glDeleteTextures(1, &textureID);
        glDeleteVertexArrays(1, &vertexArrayID);
-       glDeleteProgram(programID);
+       ReleaseShaderProgram(programID);
     }
 };
 
@@ -238,22 +243,109 @@ struct MyBot {
 	};
 	std::vector<PrimitiveObject> primitiveObjects;
 
+	// The default scene's nodes flattened so that every parent comes before its children.
+	// Poses and transforms are indexed by this order ("flat index"), and a node's global
+	// transform is its parent's times its local one, so one linear pass computes them all.
+	struct Skeleton {
+		std::vector<int> nodes;         // flat index -> glTF node
+		std::vector<int> parents;       // flat index -> flat index of the parent, -1 for a root
+		std::vector<int> flatIndex;     // glTF node -> flat index, -1 if not in the scene
+	};
+	Skeleton skeleton;
+
 	struct SkinObject {
+		std::vector<int> joints;        // flat indices, -1 for a joint outside the scene
 		std::vector<glm::mat4> inverseBindMatrices;  
 		std::vector<glm::mat4> globalJointTransforms;
 		std::vector<glm::mat4> jointMatrices;
 	};
 	std::vector<SkinObject> skinObjects;
 
-	struct SamplerObject {
-		std::vector<float> input;
-		std::vector<glm::vec4> output;
-		int interpolation;
+	enum ChannelPath { PATH_TRANSLATION, PATH_ROTATION, PATH_SCALE };
+
+	// Key times shared by every channel whose sampler uses the same input accessor
+	struct TimeTrack {
+		int keyCount;
+		int timeOffset;     // into AnimationClip::times
+	};
+
+	// One animated property of one node; its keys are ranges of the clip's arrays
+	struct ClipChannel {
+		int node;
+		ChannelPath path;
+		bool step;          // STEP interpolation: hold each key until the next
+		int track;          // into AnimationClip::tracks
+		int valueOffset;    // into AnimationClip::vec3Values (translation, scale) or quatValues (rotation)
+	};
+
+	// A glTF animation compiled at load time. Channels are sorted by target node and every
+	// key is copied into typed arrays, so sampling never looks at the model or its buffers.
+	struct AnimationClip {
+		std::vector<TimeTrack> tracks;
+		std::vector<ClipChannel> channels;
+		std::vector<float> times;
+		std::vector<glm::vec3> vec3Values;
+		std::vector<glm::quat> quatValues;
+	};
+	std::vector<AnimationClip> clips;
+
+	// Where one time track is this frame: interpolate key0 -> key1 by factor
+	struct TrackSample {
+		int key0, key1;
+		float factor;
+	};
+
+	// Playback of one clip. Time usually only moves forward, so each track keeps the key it
+	// was at last frame and walks on from there instead of searching again.
+	struct ClipPlayback {
+		int clip = -1;
+		std::vector<int> cursors;           // per track
+		std::vector<TrackSample> samples;   // per track, this frame
+	};
+
+	// Local node pose as one array per component (SoA), indexed by flat index
+	struct PoseBuffers {
+		std::vector<glm::vec3> translations;
+		std::vector<glm::quat> rotations;
+		std::vector<glm::vec3> scales;
 	};
-	struct AnimationObject {
-		std::vector<SamplerObject> samplers;
+
+	enum LayerBlend {
+		BLEND_OVERRIDE,     // move the pose below toward the clip by the layer weight
+		BLEND_ADDITIVE      // add the clip's change from its first key, scaled by the weight
+	};
+
+	// One clip playing on top of the layers below it. A crossfade freezes the pose the
+	// layers up to this one show at that moment (even halfway through another fade) in
+	// `fadeSource`, and blends from it to the new clip over fadeDuration seconds.
+	struct AnimationLayer {
+		ClipPlayback current;
+		PoseBuffers fadeSource;
+		float time = 0.0f;
+		float speed = 1.0f;
+		float weight = 0.0f;                // 0 turns the layer off
+		float fade = 1.0f;                  // 0 -> 1 from fadeSource to the clip
+		float fadeDuration = 0.0f;
+		LayerBlend blend = BLEND_OVERRIDE;
+		int mask = -1;                      // into jointMasks; -1 for every joint
 	};
-	std::vector<AnimationObject> animationObjects;
+
+	// Applied in order, starting from the rest pose
+	static const int MAX_LAYERS = 4;
+	AnimationLayer layers[MAX_LAYERS];
+
+	// Per-joint layer weights, indexed by flat index
+	std::vector<std::vector<float> > jointMasks;
+
+	// Where crossfade() evaluates the layers before they become a fade source
+	PoseBuffers crossfadePose;
+
+	// Sized once in preparePose() and overwritten in place every update(), so animating
+	// does no heap allocation
+	PoseBuffers restPose;                       // node TRS from the file
+	PoseBuffers pose;                           // rest pose with this frame's channels applied
+	std::vector<glm::mat4> nodeTransforms;      // local matrices of `pose`
+	std::vector<glm::mat4> globalTransforms;    // nodeTransforms accumulated down the hierarchy
 
 	glm::mat4 getNodeTransform(const tinygltf::Node& node) {
 		glm::mat4 transform(1.0f); 
@@ -274,22 +366,57 @@ struct MyBot {
 		return transform;
 	}
 
-	void computeLocalNodeTransform(const tinygltf::Model& model, int nodeIndex, std::vector<glm::mat4> &localTransforms) {
-        const tinygltf::Node& node = model.nodes[nodeIndex];
-        localTransforms[nodeIndex] = getNodeTransform(node);
-        for (int childIndex : node.children) {
-            computeLocalNodeTransform(model, childIndex, localTransforms);
-        }
-    }
+	Skeleton buildSkeleton(const tinygltf::Model &model) {
+		Skeleton skeleton;
+		skeleton.flatIndex.assign(model.nodes.size(), -1);
+		if (model.scenes.empty()) return skeleton;
 
-	void computeGlobalNodeTransform(const tinygltf::Model& model, const std::vector<glm::mat4> &localTransforms, int nodeIndex, const glm::mat4& parentTransform, std::vector<glm::mat4> &globalTransforms) {
-        glm::mat4 currentGlobalTransform = parentTransform * localTransforms[nodeIndex];
-        globalTransforms[nodeIndex] = currentGlobalTransform;
-        const tinygltf::Node& node = model.nodes[nodeIndex];
-        for (int childIndex : node.children) {
-            computeGlobalNodeTransform(model, localTransforms, childIndex, currentGlobalTransform, globalTransforms);
-        }
-    }
+		// Depth-first with an explicit stack: (node, parent's flat index)
+		std::vector<std::pair<int, int> > stack;
+		const tinygltf::Scene &scene = model.scenes[std::max(model.defaultScene, 0)];
+		for (size_t i = scene.nodes.size(); i-- > 0; ) {
+			stack.push_back(std::make_pair(scene.nodes[i], -1));
+		}
+		while (!stack.empty()) {
+			int nodeIndex = stack.back().first;
+			int parent = stack.back().second;
+			stack.pop_back();
+			if (skeleton.flatIndex[nodeIndex] >= 0) continue;  // not a tree; keep the first parent
+
+			int flat = int(skeleton.nodes.size());
+			skeleton.flatIndex[nodeIndex] = flat;
+			skeleton.nodes.push_back(nodeIndex);
+			skeleton.parents.push_back(parent);
+
+			const std::vector<int> &children = model.nodes[nodeIndex].children;
+			for (size_t i = children.size(); i-- > 0; ) {
+				stack.push_back(std::make_pair(children[i], flat));
+			}
+		}
+		return skeleton;
+	}
+
+	// Global transforms from local ones, both indexed by flat index
+	void computeGlobalTransforms(const std::vector<glm::mat4> &localTransforms, std::vector<glm::mat4> &globalTransforms) {
+		const int *parents = skeleton.parents.data();
+		const glm::mat4 *local = localTransforms.data();
+		glm::mat4 *global = globalTransforms.data();
+		const int count = int(skeleton.parents.size());
+		for (int i = 0; i < count; ++i) {
+			global[i] = parents[i] < 0 ? local[i] : global[parents[i]] * local[i];
+		}
+	}
+
+	// Joint matrices of every skin from the global transforms of the skeleton
+	static void computeJointMatrices(const std::vector<glm::mat4> &globalTransforms, std::vector<SkinObject> &skinObjects) {
+		for (SkinObject &skinObject : skinObjects) {
+			for (size_t j = 0; j < skinObject.joints.size(); ++j) {
+				int flat = skinObject.joints[j];
+				skinObject.globalJointTransforms[j] = flat >= 0 ? globalTransforms[flat] : glm::mat4(1.0f);
+				skinObject.jointMatrices[j] = skinObject.globalJointTransforms[j] * skinObject.inverseBindMatrices[j];
+			}
+		}
+	}
 
 	std::vector<SkinObject> prepareSkinning(const tinygltf::Model &model) {
 		std::vector<SkinObject> skinObjects;
@@ -307,35 +434,32 @@ struct MyBot {
 				memcpy(m, ptr + j * 16, 16 * sizeof(float));
 				skinObject.inverseBindMatrices[j] = glm::make_mat4(m);
 			}
+			skinObject.joints.resize(skin.joints.size());
+			for (size_t j = 0; j < skin.joints.size(); j++) {
+				skinObject.joints[j] = skeleton.flatIndex[skin.joints[j]];
+			}
 			skinObject.globalJointTransforms.resize(skin.joints.size());
 			skinObject.jointMatrices.resize(skin.joints.size());
-
-            std::vector<glm::mat4> localTransforms(model.nodes.size());
-            std::vector<glm::mat4> globalTransforms(model.nodes.size());
-
-            const tinygltf::Scene &scene = model.scenes[model.defaultScene];
-            for (size_t k = 0; k < scene.nodes.size(); ++k) {
-                computeLocalNodeTransform(model, scene.nodes[k], localTransforms);
-            }
-            for (size_t k = 0; k < scene.nodes.size(); ++k) {
-                computeGlobalNodeTransform(model, localTransforms, scene.nodes[k], glm::mat4(1.0f), globalTransforms);
-            }
-            for (size_t j = 0; j < skin.joints.size(); ++j) {
-                int nodeIndex = skin.joints[j];
-                skinObject.globalJointTransforms[j] = globalTransforms[nodeIndex];
-                skinObject.jointMatrices[j] = globalTransforms[nodeIndex] * skinObject.inverseBindMatrices[j];
-            }
 			skinObjects.push_back(skinObject);
 		}
+
+		// Bind pose from the nodes' own transforms
+		std::vector<glm::mat4> localTransforms(skeleton.nodes.size());
+		std::vector<glm::mat4> globalTransforms(skeleton.nodes.size());
+		for (size_t i = 0; i < skeleton.nodes.size(); ++i) {
+			localTransforms[i] = getNodeTransform(model.nodes[skeleton.nodes[i]]);
+		}
+		computeGlobalTransforms(localTransforms, globalTransforms);
+		computeJointMatrices(globalTransforms, skinObjects);
 		return skinObjects;
 	}
 
-	int findKeyframeIndex(const std::vector<float>& times, float animationTime) {
+	int findKeyframeIndex(const float *times, int count, float animationTime) {
 		int left = 0;
-		int right = times.size() - 1;
+		int right = count - 1;
 		while (left <= right) {
 			int mid = (left + right) / 2;
-			if (mid + 1 < times.size() && times[mid] <= animationTime && animationTime < times[mid + 1]) {
+			if (mid + 1 < count && times[mid] <= animationTime && animationTime < times[mid + 1]) {
 				return mid;
 			} else if (times[mid] > animationTime) {
 				right = mid - 1;
@@ -343,119 +467,303 @@ struct MyBot {
 				left = mid + 1;
 			}
 		}
-		return times.size() - 2;
+		return count - 2;
 	}
 
-	std::vector<AnimationObject> prepareAnimation(const tinygltf::Model &model) {
-		std::vector<AnimationObject> animationObjects;
+	static const unsigned char *accessorData(const tinygltf::Model &model, const tinygltf::Accessor &accessor, int &stride) {
+		const tinygltf::BufferView &bufferView = model.bufferViews[accessor.bufferView];
+		const tinygltf::Buffer &buffer = model.buffers[bufferView.buffer];
+		stride = accessor.ByteStride(bufferView);
+		return &buffer.data[bufferView.byteOffset + accessor.byteOffset];
+	}
+
+	std::vector<AnimationClip> compileAnimations(const tinygltf::Model &model) {
+		std::vector<AnimationClip> clips;
 		for (const auto &anim : model.animations) {
-			AnimationObject animationObject;
-			for (const auto &sampler : anim.samplers) {
-				SamplerObject samplerObject;
+			AnimationClip clip;
+			std::map<int, int> trackOfInput;
+			for (const auto &channel : anim.channels) {
+				ClipChannel compiled;
+				if (channel.target_path == "translation") compiled.path = PATH_TRANSLATION;
+				else if (channel.target_path == "rotation") compiled.path = PATH_ROTATION;
+				else if (channel.target_path == "scale") compiled.path = PATH_SCALE;
+				else continue;  // morph target weights are not supported
+				if (channel.target_node < 0 || channel.sampler < 0) continue;
+				if (skeleton.flatIndex[channel.target_node] < 0) continue;  // not in the scene
+
+				const tinygltf::AnimationSampler &sampler = anim.samplers[channel.sampler];
 				const tinygltf::Accessor &inputAccessor = model.accessors[sampler.input];
-				const tinygltf::BufferView &inputBufferView = model.bufferViews[inputAccessor.bufferView];
-				const tinygltf::Buffer &inputBuffer = model.buffers[inputBufferView.buffer];
-				samplerObject.input.resize(inputAccessor.count);
-				const unsigned char *inputPtr = &inputBuffer.data[inputBufferView.byteOffset + inputAccessor.byteOffset];
-				int stride = inputAccessor.ByteStride(inputBufferView);
-				for (size_t i = 0; i < inputAccessor.count; ++i) {
-					samplerObject.input[i] = *reinterpret_cast<const float*>(inputPtr + i * stride);
-				}
 				const tinygltf::Accessor &outputAccessor = model.accessors[sampler.output];
-				const tinygltf::BufferView &outputBufferView = model.bufferViews[outputAccessor.bufferView];
-				const tinygltf::Buffer &outputBuffer = model.buffers[outputBufferView.buffer];
-				const unsigned char *outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
-				samplerObject.output.resize(outputAccessor.count);
-				for (size_t i = 0; i < outputAccessor.count; ++i) {
-					if (outputAccessor.type == TINYGLTF_TYPE_VEC3) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 3 * sizeof(float), 3 * sizeof(float));
-					} else if (outputAccessor.type == TINYGLTF_TYPE_VEC4) {
-						memcpy(&samplerObject.output[i], outputPtr + i * 4 * sizeof(float), 4 * sizeof(float));
+				if (inputAccessor.count == 0) continue;
+
+				compiled.node = skeleton.flatIndex[channel.target_node];
+				compiled.step = sampler.interpolation == "STEP";
+				compiled.valueOffset = int(compiled.path == PATH_ROTATION ? clip.quatValues.size() : clip.vec3Values.size());
+
+				int stride;
+				std::map<int, int>::iterator shared = trackOfInput.find(sampler.input);
+				if (shared != trackOfInput.end()) {
+					compiled.track = shared->second;
+				} else {
+					TimeTrack track;
+					track.keyCount = int(inputAccessor.count);
+					track.timeOffset = int(clip.times.size());
+					const unsigned char *inputPtr = accessorData(model, inputAccessor, stride);
+					for (int i = 0; i < track.keyCount; ++i) {
+						clip.times.push_back(*reinterpret_cast<const float*>(inputPtr + i * stride));
 					}
+					compiled.track = trackOfInput[sampler.input] = int(clip.tracks.size());
+					clip.tracks.push_back(track);
 				}
-				animationObject.samplers.push_back(samplerObject);			
+				const int keyCount = clip.tracks[compiled.track].keyCount;
+
+				// CUBICSPLINE stores in-tangent, value, out-tangent per key; only the value is
+				// kept and interpolated linearly
+				bool cubic = sampler.interpolation == "CUBICSPLINE";
+				const unsigned char *outputPtr = accessorData(model, outputAccessor, stride);
+				for (int i = 0; i < keyCount; ++i) {
+					const float *value = reinterpret_cast<const float*>(outputPtr + (cubic ? 3 * i + 1 : i) * stride);
+					if (compiled.path == PATH_ROTATION) clip.quatValues.push_back(glm::make_quat(value));
+					else clip.vec3Values.push_back(glm::make_vec3(value));
+				}
+				clip.channels.push_back(compiled);
 			}
-			animationObjects.push_back(animationObject);
-		}
-		return animationObjects;
-	}
-
-	void updateAnimation(const tinygltf::Model &model, const tinygltf::Animation &anim, const AnimationObject &animationObject, float time, std::vector<glm::vec3> &translations, std::vector<glm::quat> &rotations, std::vector<glm::vec3> &scales) {
-        for (const auto &channel : anim.channels) {
-            int targetNodeIndex = channel.target_node;
-            const auto &sampler = anim.samplers[channel.sampler];
-            const tinygltf::Accessor &outputAccessor = model.accessors[sampler.output];
-            const tinygltf::BufferView &outputBufferView = model.bufferViews[outputAccessor.bufferView];
-            const tinygltf::Buffer &outputBuffer = model.buffers[outputBufferView.buffer];
-            const std::vector<float> &times = animationObject.samplers[channel.sampler].input;
-            float animationTime = fmod(time, times.back());
-            int keyframeIndex = findKeyframeIndex(times, animationTime);
-            const unsigned char *outputPtr = &outputBuffer.data[outputBufferView.byteOffset + outputAccessor.byteOffset];
-            float t1 = times[keyframeIndex];
-            float t2 = times[keyframeIndex + 1];
-            float factor = (animationTime - t1) / (t2 - t1);
-
-            if (channel.target_path == "translation") {
-                glm::vec3 translation0, translation1;
-                memcpy(&translation0, outputPtr + keyframeIndex * 3 * sizeof(float), 3 * sizeof(float));
-                memcpy(&translation1, outputPtr + (keyframeIndex + 1) * 3 * sizeof(float), 3 * sizeof(float));
-                glm::vec3 translation = glm::mix(translation0, translation1, factor);
-                translations[targetNodeIndex] = translation;
-            } else if (channel.target_path == "rotation") {
-                glm::quat rotation0, rotation1;
-                memcpy(&rotation0, outputPtr + keyframeIndex * 4 * sizeof(float), 4 * sizeof(float));
-                memcpy(&rotation1, outputPtr + (keyframeIndex + 1) * 4 * sizeof(float), 4 * sizeof(float));
-                glm::quat rotation = glm::slerp(rotation0, rotation1, factor);
-                rotations[targetNodeIndex] = rotation;
-            } else if (channel.target_path == "scale") {
-                glm::vec3 scale0, scale1;
-                memcpy(&scale0, outputPtr + keyframeIndex * 3 * sizeof(float), 3 * sizeof(float));
-                memcpy(&scale1, outputPtr + (keyframeIndex + 1) * 3 * sizeof(float), 3 * sizeof(float));
-                glm::vec3 scale = glm::mix(scale0, scale1, factor);
-                scales[targetNodeIndex] = scale;
-            }
-        }
-    }
+			// Stable, so a later channel on the same node and path still wins
+			std::stable_sort(clip.channels.begin(), clip.channels.end(), [](const ClipChannel &a, const ClipChannel &b) {
+				return a.node < b.node;
+			});
+			clips.push_back(clip);
+		}
+		return clips;
+	}
+
+	// Keyframe segment containing animationTime, starting from the one found last time.
+	// Moving forward a few keys is a short walk; going back (a seek or the loop wrapping
+	// around) or far ahead falls back to the binary search.
+	int advanceKeyframeIndex(const float *times, int count, float animationTime, int cursor) {
+		const int maxWalk = 4;
+		if (cursor < 0 || cursor > count - 2 || animationTime < times[cursor]) {
+			return findKeyframeIndex(times, count, animationTime);
+		}
+		for (int step = 0; cursor + 1 < count - 1 && times[cursor + 1] <= animationTime; ++step) {
+			if (step == maxWalk) return findKeyframeIndex(times, count, animationTime);
+			++cursor;
+		}
+		return cursor;
+	}
+
+	void startPlayback(ClipPlayback &playback, int clip) {
+		playback.clip = clip;
+		playback.cursors.assign(clips[clip].tracks.size(), 0);
+		playback.samples.resize(clips[clip].tracks.size());
+	}
+
+	// Sizes every layer's playback for the largest clip and its fade source for the
+	// skeleton, so switching clips later does not allocate, and starts clip 0 on layer 0
+	void prepareLayers() {
+		size_t maxTracks = 0;
+		for (const AnimationClip &clip : clips) maxTracks = std::max(maxTracks, clip.tracks.size());
+		for (AnimationLayer &layer : layers) {
+			layer.current.cursors.reserve(maxTracks);
+			layer.current.samples.reserve(maxTracks);
+			layer.fadeSource.translations.resize(skeleton.nodes.size());
+			layer.fadeSource.rotations.resize(skeleton.nodes.size());
+			layer.fadeSource.scales.resize(skeleton.nodes.size());
+		}
+		crossfadePose = layers[0].fadeSource;
+		if (clips.size() > 0) play(0, 0);
+	}
+
+	// Layer 1 adds the last clip's motion on top of layer 0, masked to the first node whose
+	// name contains "spine" and everything below it (every joint when there is none)
+	void prepareOverlayLayer(const tinygltf::Model &model) {
+		if (clips.empty()) return;
+		int node = -1;
+		for (size_t i = 0; i < model.nodes.size() && node < 0; ++i) {
+			std::string name = model.nodes[i].name;
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			if (name.find("spine") != std::string::npos) node = int(i);
+		}
+		play(1, int(clips.size()) - 1, BLEND_ADDITIVE);
+		layers[1].weight = overlayLayerWeight;
+		layers[1].mask = node >= 0 ? addJointMask(node) : -1;
+	}
+
+	// Starts `clip` on `layer` right away at full weight
+	void play(int layer, int clip, LayerBlend blend = BLEND_OVERRIDE) {
+		AnimationLayer &target = layers[layer];
+		startPlayback(target.current, clip);
+		target.time = 0.0f;
+		target.fade = 1.0f;
+		target.weight = 1.0f;
+		target.blend = blend;
+	}
+
+	// Fades `layer` from what it plays now to `clip` over `duration` seconds
+	void crossfade(int layer, int clip, float duration) {
+		AnimationLayer &target = layers[layer];
+		if (target.current.clip < 0 || target.weight <= 0.0f || duration <= 0.0f) {
+			play(layer, clip, target.blend);
+			return;
+		}
+		// The pose shown now, including a fade still in progress, is where the new one starts.
+		// It is built aside because a fade in progress still reads the old source.
+		applyLayers(layer + 1, crossfadePose);
+		std::swap(crossfadePose, target.fadeSource);
+		startPlayback(target.current, clip);
+		target.time = 0.0f;
+		target.fade = 0.0f;
+		target.fadeDuration = duration;
+	}
+
+	// New mask that lets a layer drive `node` (a glTF node index) and everything below it
+	int addJointMask(int node) {
+		std::vector<float> mask(skeleton.nodes.size(), 0.0f);
+		int root = skeleton.flatIndex[node];
+		if (root >= 0) {
+			// Depth-first order keeps a subtree contiguous: it ends at the first node
+			// whose parent is outside it (or that is another scene root)
+			mask[root] = 1.0f;
+			for (size_t i = root + 1; i < mask.size() && skeleton.parents[i] >= 0 && mask[skeleton.parents[i]] > 0.0f; ++i) {
+				mask[i] = 1.0f;
+			}
+		}
+		jointMasks.push_back(mask);
+		return int(jointMasks.size()) - 1;
+	}
+
+	// Samples the clip at `time` and blends it into `pose` with `weight`, scaled per joint
+	// by `mask` (may be null). Only the clip's channels are touched.
+	void sampleClip(ClipPlayback &playback, float time, float weight, LayerBlend blend, const float *mask, PoseBuffers &pose) {
+		const AnimationClip &clip = clips[playback.clip];
+
+		// One keyframe lookup per time track, shared by all of its channels
+		for (size_t i = 0; i < clip.tracks.size(); ++i) {
+			const TimeTrack &track = clip.tracks[i];
+			TrackSample &sample = playback.samples[i];
+			if (track.keyCount < 2) {
+				sample.key0 = sample.key1 = 0;
+				sample.factor = 0.0f;
+				continue;
+			}
+			const float *times = &clip.times[track.timeOffset];
+			float animationTime = fmod(time, times[track.keyCount - 1]);
+			int key = advanceKeyframeIndex(times, track.keyCount, animationTime, playback.cursors[i]);
+			playback.cursors[i] = key;
+			sample.key0 = key;
+			sample.key1 = key + 1;
+			sample.factor = (animationTime - times[key]) / (times[key + 1] - times[key]);
+		}
+
+		for (const ClipChannel &channel : clip.channels) {
+			float w = mask ? weight * mask[channel.node] : weight;
+			if (w <= 0.0f) continue;
+
+			const TrackSample &sample = playback.samples[channel.track];
+			int k0 = channel.valueOffset + sample.key0;
+			int k1 = channel.valueOffset + sample.key1;
+			float factor = channel.step ? 0.0f : sample.factor;
+
+			if (channel.path == PATH_ROTATION) {
+				glm::quat value = glm::slerp(clip.quatValues[k0], clip.quatValues[k1], factor);
+				glm::quat &target = pose.rotations[channel.node];
+				if (blend == BLEND_ADDITIVE) {
+					// Rotation relative to the first key, applied in the joint's own frame
+					glm::quat delta = glm::inverse(clip.quatValues[channel.valueOffset]) * value;
+					target = target * glm::slerp(glm::quat(1.0f, 0.0f, 0.0f, 0.0f), delta, w);
+				} else {
+					target = w >= 1.0f ? value : glm::slerp(target, value, w);
+				}
+			} else {
+				glm::vec3 value = glm::mix(clip.vec3Values[k0], clip.vec3Values[k1], factor);
+				glm::vec3 &target = channel.path == PATH_TRANSLATION ? pose.translations[channel.node] : pose.scales[channel.node];
+				if (blend == BLEND_ADDITIVE) {
+					const glm::vec3 &reference = clip.vec3Values[channel.valueOffset];
+					if (channel.path == PATH_TRANSLATION) {
+						target += (value - reference) * w;
+					} else {
+						// Scale relative to the first key; a zero reference component has no ratio
+						glm::vec3 ratio(1.0f);
+						for (int c = 0; c < 3; ++c) {
+							if (fabs(reference[c]) > 1e-6f) ratio[c] = value[c] / reference[c];
+						}
+						target *= glm::mix(glm::vec3(1.0f), ratio, w);
+					}
+				} else {
+					target = w >= 1.0f ? value : glm::mix(target, value, w);
+				}
+			}
+		}
+	}
+
+	void preparePose(const tinygltf::Model &model) {
+		const size_t count = skeleton.nodes.size();
+		restPose.translations.resize(count);
+		restPose.rotations.resize(count);
+		restPose.scales.resize(count);
+		for (size_t i = 0; i < count; ++i) {
+			const tinygltf::Node &node = model.nodes[skeleton.nodes[i]];
+			if (node.translation.size() == 3) restPose.translations[i] = glm::make_vec3(node.translation.data());
+			else restPose.translations[i] = glm::vec3(0.0f);
+			if (node.rotation.size() == 4) restPose.rotations[i] = glm::make_quat(node.rotation.data());
+			else restPose.rotations[i] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			if (node.scale.size() == 3) restPose.scales[i] = glm::make_vec3(node.scale.data());
+			else restPose.scales[i] = glm::vec3(1.0f);
+		}
+		pose = restPose;
+		nodeTransforms.assign(count, glm::mat4(1.0f));
+		globalTransforms.assign(count, glm::mat4(1.0f));
+	}
 
 	void updateSkinning(const std::vector<glm::mat4> &nodeTransforms) {
-        std::vector<glm::mat4> globalTransforms(model.nodes.size());
-        const tinygltf::Scene &scene = model.scenes[model.defaultScene];
-        for (size_t i = 0; i < scene.nodes.size(); ++i) {
-            computeGlobalNodeTransform(model, nodeTransforms, scene.nodes[i], glm::mat4(1.0f), globalTransforms);
-        }
-        for (SkinObject &skinObject : skinObjects) {
-             const tinygltf::Skin &skin = model.skins[0];
-             for (size_t j = 0; j < skin.joints.size(); ++j) {
-                 int jointNodeIndex = skin.joints[j];
-                 skinObject.globalJointTransforms[j] = globalTransforms[jointNodeIndex];
-                 skinObject.jointMatrices[j] = globalTransforms[jointNodeIndex] * skinObject.inverseBindMatrices[j];
-             }
-        }
+        computeGlobalTransforms(nodeTransforms, globalTransforms);
+        computeJointMatrices(globalTransforms, skinObjects);
     }
 
-	void update(float time) {
-        if (model.animations.size() > 0) {
-            const tinygltf::Animation &animation = model.animations[0];
-            const AnimationObject &animationObject = animationObjects[0];
-            std::vector<glm::vec3> translations(model.nodes.size());
-            std::vector<glm::quat> rotations(model.nodes.size());
-            std::vector<glm::vec3> scales(model.nodes.size());
-
-            for (size_t i = 0; i < model.nodes.size(); ++i) {
-                const tinygltf::Node &node = model.nodes[i];
-                if (node.translation.size() == 3) translations[i] = glm::make_vec3(node.translation.data());
-                else translations[i] = glm::vec3(0.0f);
-                if (node.rotation.size() == 4) rotations[i] = glm::make_quat(node.rotation.data());
-                else rotations[i] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
-                if (node.scale.size() == 3) scales[i] = glm::make_vec3(node.scale.data());
-                else scales[i] = glm::vec3(1.0f);
+	// Moves every joint of `pose` toward `source` by `weight`, scaled per joint by `mask`
+	// (may be null)
+	static void blendPose(const PoseBuffers &source, float weight, const float *mask, PoseBuffers &pose) {
+		for (size_t i = 0; i < pose.translations.size(); ++i) {
+			float w = mask ? weight * mask[i] : weight;
+			if (w <= 0.0f) continue;
+			pose.translations[i] = glm::mix(pose.translations[i], source.translations[i], w);
+			pose.rotations[i] = glm::slerp(pose.rotations[i], source.rotations[i], w);
+			pose.scales[i] = glm::mix(pose.scales[i], source.scales[i], w);
+		}
+	}
+
+	// The rest pose with layers [0, layerEnd) applied at their current times and fades.
+	// A fading layer also blends every joint it may drive back toward its fade source, so
+	// joints only the old clip animated ease to the new pose instead of snapping.
+	void applyLayers(int layerEnd, PoseBuffers &out) {
+		std::copy(restPose.translations.begin(), restPose.translations.end(), out.translations.begin());
+		std::copy(restPose.rotations.begin(), restPose.rotations.end(), out.rotations.begin());
+		std::copy(restPose.scales.begin(), restPose.scales.end(), out.scales.begin());
+
+		for (int i = 0; i < layerEnd; ++i) {
+			AnimationLayer &layer = layers[i];
+			if (layer.weight <= 0.0f || layer.current.clip < 0) continue;
+			const float *mask = layer.mask >= 0 ? jointMasks[layer.mask].data() : NULL;
+
+			sampleClip(layer.current, layer.time, layer.weight, layer.blend, mask, out);
+			if (layer.fade < 1.0f) blendPose(layer.fadeSource, 1.0f - layer.fade, mask, out);
+		}
+	}
+
+	// Advances every active layer by deltaTime (scaled by its speed) and poses the skins
+	void update(float deltaTime) {
+        if (clips.size() > 0) {
+            for (AnimationLayer &layer : layers) {
+                if (layer.weight <= 0.0f || layer.current.clip < 0) continue;
+                layer.time += deltaTime * layer.speed;
+                if (layer.fade < 1.0f) layer.fade = std::min(layer.fade + deltaTime / layer.fadeDuration, 1.0f);
             }
-            updateAnimation(model, animation, animationObject, time, translations, rotations, scales);
-            std::vector<glm::mat4> nodeTransforms(model.nodes.size());
-            for (size_t i = 0; i < model.nodes.size(); ++i) {
-                glm::mat4 t = glm::translate(glm::mat4(1.0f), translations[i]);
-                glm::mat4 r = glm::mat4_cast(rotations[i]);
-                glm::mat4 s = glm::scale(glm::mat4(1.0f), scales[i]);
+            applyLayers(MAX_LAYERS, pose);
+
+            for (size_t i = 0; i < nodeTransforms.size(); ++i) {
+                glm::mat4 t = glm::translate(glm::mat4(1.0f), pose.translations[i]);
+                glm::mat4 r = glm::mat4_cast(pose.rotations[i]);
+                glm::mat4 s = glm::scale(glm::mat4(1.0f), pose.scales[i]);
                 nodeTransforms[i] = t * r * s;
             }
             updateSkinning(nodeTransforms);
@@ -479,8 +787,12 @@ struct MyBot {
 			return;
 		}
 		primitiveObjects = bindModel(model);
+		skeleton = buildSkeleton(model);
 		skinObjects = prepareSkinning(model);
-		animationObjects = prepareAnimation(model);
+		clips = compileAnimations(model);
+		prepareLayers();
+		preparePose(model);
+		prepareOverlayLayer(model);
 
 		programID = LoadShadersFromFile("../lab4/shader/bot.vert", "../lab4/shader/bot.frag");
 		if (programID == 0) std::cerr << "Failed to load shaders." << std::endl;
@@ -604,7 +916,7 @@ struct MyBot {
 	}
 
 	void cleanup() {
-		glDeleteProgram(programID);
+		ReleaseShaderProgram(programID);
 	}
 }; 
 
@@ -657,7 +969,6 @@ int main(void)
 	projectionMatrix = glm::perspective(glm::radians(FoV), (float)windowWidth / windowHeight, zNear, zFar);
 
 	static double lastTime = glfwGetTime();
-	float time = 0.0f;			
 	float fTime = 0.0f;			
 	unsigned long frames = 0;
 
@@ -670,9 +981,16 @@ int main(void)
         float deltaTime = float(currentTime - lastTime);
 		lastTime = currentTime;
 
+		if (crossfadeToNextClip) {
+			crossfadeToNextClip = false;
+			if (bot.clips.size() > 0) {
+				int next = (bot.layers[0].current.clip + 1) % int(bot.clips.size());
+				bot.crossfade(0, next, 0.5f);
+			}
+		}
+		bot.layers[1].weight = overlayLayerOn ? overlayLayerWeight : 0.0f;
 		if (playAnimation) {
-			time += deltaTime * playbackSpeed;
-			bot.update(time);
+			bot.update(deltaTime * playbackSpeed);
 		} 
 
         // -----------------------------------------------------------
@@ -763,6 +1081,16 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
 		playAnimation = !playAnimation;
 	}
 
+    // Crossfade to the next clip
+    if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+		crossfadeToNextClip = true;
+	}
+
+    // Toggle the masked additive layer
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		overlayLayerOn = !overlayLayerOn;
+	}
+
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 }
\ No newline at end of file
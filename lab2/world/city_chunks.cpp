@@ -0,0 +1,216 @@
+#include "city_chunks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Murmur3 finaliser: cheap, and every input bit affects every output bit
+static unsigned int Mix(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static unsigned int HashChunk(int cx, int cz, unsigned int seed) {
+    return Mix(seed ^ Mix(unsigned(cx) * 0x8da6b343u ^ Mix(unsigned(cz) * 0xd8163841u)));
+}
+
+// xorshift32; the generator's own state, so chunks never share rand()
+struct ChunkRandom {
+    unsigned int state;
+
+    explicit ChunkRandom(unsigned int seed) : state(seed ? seed : 0x9e3779b9u) {}
+
+    float next01() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return float(state >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+void GenerateChunk(int cx, int cz, const CityParams& params, std::vector<BuildingDesc>& out) {
+    out.clear();
+    ChunkRandom rng(HashChunk(cx, cz, params.seed));
+
+    // One building per lot at most, jittered inside the lot so footprints never overlap
+    const float lot = params.chunkSize / params.lotsPerSide;
+    const float jitter = std::max(0.0f, lot * 0.5f - params.baseSize - 4.0f);
+    const float originX = cx * params.chunkSize;
+    const float originZ = cz * params.chunkSize;
+
+    for (int lz = 0; lz < params.lotsPerSide; ++lz) {
+        for (int lx = 0; lx < params.lotsPerSide; ++lx) {
+            // Always draw the same number of values per lot, so one lot never shifts another
+            float build = rng.next01();
+            float jx = rng.next01() * 2.0f - 1.0f;
+            float jz = rng.next01() * 2.0f - 1.0f;
+            float height = rng.next01();
+            float facade = rng.next01();
+            if (build >= params.buildChance) continue;
+
+            BuildingDesc b;
+            b.position = glm::vec3(originX + (lx + 0.5f) * lot + jx * jitter, 0.0f,
+                                   originZ + (lz + 0.5f) * lot + jz * jitter);
+            b.scale = glm::vec3(params.baseSize, params.minHeight + height * params.heightRange, params.baseSize);
+            b.facadeLayer = int(facade * params.facadeCount) % params.facadeCount;
+            out.push_back(b);
+        }
+    }
+}
+
+void CityStreamer::start(int workerCount) {
+    // A chunk within unloadRadius of the player is at most floor(r / size) + 1 chunks away
+    int span = int(std::ceil(unloadRadius / params.chunkSize)) + 1;
+    int count = (2 * span + 1) * (2 * span + 1);
+    slots.assign(count, ChunkSlot());
+    freeSlots.clear();
+    for (int i = count - 1; i >= 0; --i) freeSlots.push_back(i);
+
+    if (workerCount <= 0) workerCount = int(std::thread::hardware_concurrency());
+    if (workerCount <= 0) workerCount = 2;
+
+    stopping = false;
+    for (int i = 0; i < workerCount; ++i) {
+        workers.push_back(std::thread(&CityStreamer::workerLoop, this));
+    }
+}
+
+void CityStreamer::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queued.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        Job job = queue.front();
+        queue.pop_front();
+        inFlight++;
+
+        lock.unlock();
+        Result r;
+        r.cx = job.cx;
+        r.cz = job.cz;
+        GenerateChunk(job.cx, job.cz, params, r.buildings);
+        lock.lock();
+
+        done.push_back(std::move(r));
+        inFlight--;
+        finished.notify_all();
+    }
+}
+
+// Distance on the XZ plane from the player to the nearest point of the chunk
+float CityStreamer::chunkDistance(int cx, int cz, const glm::vec3& playerPos) const {
+    float minX = cx * params.chunkSize, minZ = cz * params.chunkSize;
+    float dx = std::max(std::max(minX - playerPos.x, playerPos.x - (minX + params.chunkSize)), 0.0f);
+    float dz = std::max(std::max(minZ - playerPos.z, playerPos.z - (minZ + params.chunkSize)), 0.0f);
+    return std::sqrt(dx * dx + dz * dz);
+}
+
+void CityStreamer::update(const glm::vec3& playerPos, std::vector<int>& loaded, std::vector<int>& unloaded) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Drop chunks that fell behind; queued ones are cancelled, running ones discarded on arrival
+    for (std::map<long long, ChunkState>::iterator it = chunks.begin(); it != chunks.end();) {
+        int cx = int(it->first >> 32), cz = int(it->first & 0xffffffff);
+        if (chunkDistance(cx, cz, playerPos) <= unloadRadius) {
+            ++it;
+            continue;
+        }
+
+        int s = it->second.slot;
+        if (s >= 0) {
+            slots[s].used = false;
+            slots[s].buildings.clear();
+            freeSlots.push_back(s);
+            unloaded.push_back(s);
+        } else {
+            for (std::deque<Job>::iterator j = queue.begin(); j != queue.end(); ++j) {
+                if (j->cx == cx && j->cz == cz) {
+                    queue.erase(j);
+                    break;
+                }
+            }
+        }
+        chunks.erase(it++);
+    }
+
+    // Request whatever is missing inside the load radius
+    int pcx = int(std::floor(playerPos.x / params.chunkSize));
+    int pcz = int(std::floor(playerPos.z / params.chunkSize));
+    int span = int(std::ceil(loadRadius / params.chunkSize)) + 1;
+    bool requested = false;
+    for (int cz = pcz - span; cz <= pcz + span; ++cz) {
+        for (int cx = pcx - span; cx <= pcx + span; ++cx) {
+            if (chunkDistance(cx, cz, playerPos) > loadRadius) continue;
+            if (chunks.find(key(cx, cz)) != chunks.end()) continue;
+
+            chunks[key(cx, cz)] = ChunkState();
+            Job job = {cx, cz};
+            queue.push_back(job);
+            requested = true;
+        }
+    }
+
+    // Nearest first, so what the player walks into is generated before what is behind
+    if (requested) {
+        std::sort(queue.begin(), queue.end(), [this, &playerPos](const Job& a, const Job& b) {
+            return chunkDistance(a.cx, a.cz, playerPos) < chunkDistance(b.cx, b.cz, playerPos);
+        });
+        queued.notify_all();
+    }
+
+    // Install finished chunks into free slots
+    size_t kept = 0;
+    for (size_t i = 0; i < done.size(); ++i) {
+        Result& r = done[i];
+        std::map<long long, ChunkState>::iterator it = chunks.find(key(r.cx, r.cz));
+        if (it == chunks.end() || it->second.slot >= 0) continue;   // unloaded meanwhile, or a duplicate
+        if (freeSlots.empty()) {
+            // Cannot happen with the slot bound from start(), but never lose a chunk
+            if (kept != i) std::swap(done[kept], r);
+            kept++;
+            continue;
+        }
+
+        int s = freeSlots.back();
+        freeSlots.pop_back();
+        it->second.slot = s;
+
+        ChunkSlot& slot = slots[s];
+        slot.used = true;
+        slot.cx = r.cx;
+        slot.cz = r.cz;
+        slot.buildings.swap(r.buildings);
+        loaded.push_back(s);
+    }
+    done.resize(kept);
+}
+
+void CityStreamer::waitForPending(const glm::vec3& playerPos, std::vector<int>& loaded, std::vector<int>& unloaded) {
+    update(playerPos, loaded, unloaded);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return queue.empty() && inFlight == 0; });
+    }
+    update(playerPos, loaded, unloaded);
+}
+
+void CityStreamer::cleanup() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    queued.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    workers.clear();
+
+    done.clear();
+    chunks.clear();
+    slots.clear();
+    freeSlots.clear();
+}
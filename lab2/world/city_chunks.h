@@ -0,0 +1,106 @@
+#ifndef _CITY_CHUNKS_H_
+#define _CITY_CHUNKS_H_
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// One generated building: world placement plus facade layer (no GL state)
+struct BuildingDesc {
+    glm::vec3 position;
+    glm::vec3 scale;
+    int facadeLayer = 0;
+};
+
+// Layout rules shared by every chunk. The same seed always yields the same city.
+struct CityParams {
+    unsigned int seed = 12345;
+    float chunkSize = 256.0f;
+    int lotsPerSide = 4;            // chunk is split into lotsPerSide^2 lots, at most one building each
+    float buildChance = 0.3f;
+    float baseSize = 16.0f;         // half-width of a building footprint
+    float minHeight = 35.0f;
+    float heightRange = 120.0f;
+    int facadeCount = 4;
+
+    int maxBuildingsPerChunk() const { return lotsPerSide * lotsPerSide; }
+};
+
+// Deterministic: depends only on (cx, cz) and `params`, so it is safe to call from any thread.
+void GenerateChunk(int cx, int cz, const CityParams& params, std::vector<BuildingDesc>& out);
+
+// A resident chunk. Its buildings own pool indices
+// [slot * maxBuildingsPerChunk, slot * maxBuildingsPerChunk + buildings.size()).
+struct ChunkSlot {
+    bool used = false;
+    int cx = 0, cz = 0;
+    std::vector<BuildingDesc> buildings;
+};
+
+// Streams chunks in and out around the player. Generation runs on worker threads;
+// update() is called from the render thread and reports which slots changed.
+struct CityStreamer {
+    CityParams params;
+    float loadRadius = 1000.0f;     // chunks closer than this are requested
+    float unloadRadius = 1200.0f;   // chunks further than this are dropped (hysteresis)
+
+    // Allocates the slot table and starts the workers (0 = one per hardware thread).
+    void start(int workerCount = 0);
+
+    // Upper bound on resident chunks, fixed by the radii and chunk size.
+    int slotCount() const { return int(slots.size()); }
+    const ChunkSlot& slot(int i) const { return slots[i]; }
+
+    // Requests missing chunks nearest-first, drops far ones and installs finished ones.
+    // Appends the changed slots; a slot can be both unloaded and reloaded in one call,
+    // so callers should apply `unloaded` before `loaded`.
+    void update(const glm::vec3& playerPos, std::vector<int>& loaded, std::vector<int>& unloaded);
+
+    // Blocks until every requested chunk is resident (used once at start-up).
+    void waitForPending(const glm::vec3& playerPos, std::vector<int>& loaded, std::vector<int>& unloaded);
+
+    void cleanup();
+
+private:
+    struct Job {
+        int cx, cz;
+    };
+
+    struct Result {
+        int cx, cz;
+        std::vector<BuildingDesc> buildings;
+    };
+
+    // Render-thread view of a chunk: queued/generating (slot < 0) or resident
+    struct ChunkState {
+        int slot = -1;
+    };
+
+    std::vector<ChunkSlot> slots;
+    std::vector<int> freeSlots;
+    std::map<long long, ChunkState> chunks;
+
+    std::deque<Job> queue;
+    std::vector<Result> done;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable finished;
+    bool stopping = false;
+    int inFlight = 0;
+
+    void workerLoop();
+    float chunkDistance(int cx, int cz, const glm::vec3& playerPos) const;
+
+    static long long key(int cx, int cz) {
+        // Shift while unsigned: shifting a negative signed value is undefined
+        return (long long)((uint64_t)(uint32_t)cx << 32 | (uint32_t)cz);
+    }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "spatial_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+void SpatialGrid::initialize(float size, size_t itemCount) {
+    cellSize = size;
+    cells.clear();
+    items.assign(itemCount, ItemSlot());
+}
+
+void SpatialGrid::cellOf(float x, float z, int& cx, int& cz) const {
+    cx = int(std::floor(x / cellSize));
+    cz = int(std::floor(z / cellSize));
+}
+
+void SpatialGrid::place(int item, float x, float z) {
+    if (item >= int(items.size())) items.resize(item + 1);
+
+    int cx, cz;
+    cellOf(x, z, cx, cz);
+    long long k = key(cx, cz);
+
+    ItemSlot& slot = items[item];
+    if (slot.placed) {
+        if (slot.cell == k) return;
+        unlink(item, slot.cell);
+    }
+
+    cells[k].push_back(item);
+    slot.placed = true;
+    slot.cell = k;
+}
+
+void SpatialGrid::remove(int item) {
+    if (item >= int(items.size()) || !items[item].placed) return;
+    unlink(item, items[item].cell);
+    items[item].placed = false;
+}
+
+// Swap-remove from the bucket; drop the bucket once it is empty
+void SpatialGrid::unlink(int item, long long cell) {
+    std::unordered_map<long long, std::vector<int> >::iterator it = cells.find(cell);
+    if (it == cells.end()) return;
+
+    std::vector<int>& bucket = it->second;
+    std::vector<int>::iterator pos = std::find(bucket.begin(), bucket.end(), item);
+    if (pos != bucket.end()) {
+        *pos = bucket.back();
+        bucket.pop_back();
+    }
+    if (bucket.empty()) cells.erase(it);
+}
+
+void SpatialGrid::queryRect(float minX, float minZ, float maxX, float maxZ, std::vector<int>& out) const {
+    int x0, z0, x1, z1;
+    cellOf(minX, minZ, x0, z0);
+    cellOf(maxX, maxZ, x1, z1);
+
+    for (int cz = z0; cz <= z1; ++cz) {
+        for (int cx = x0; cx <= x1; ++cx) {
+            std::unordered_map<long long, std::vector<int> >::const_iterator it = cells.find(key(cx, cz));
+            if (it != cells.end()) out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef _SPATIAL_GRID_H_
+#define _SPATIAL_GRID_H_
+
+#include <cstddef>
+#include <unordered_map>
+#include <cstdint>
+#include <vector>
+
+// Uniform grid over the XZ plane, stored sparsely as a hash of occupied cells.
+// Items are plain indices (e.g. into the building pool) bucketed by their x/z position.
+struct SpatialGrid {
+    float cellSize = 128.0f;
+
+    void initialize(float cellSize, size_t itemCount);
+
+    void cellOf(float x, float z, int& cx, int& cz) const;
+
+    // Places an item, or moves it if it is already in the grid.
+    void place(int item, float x, float z);
+
+    // Takes an item out of the grid; no-op if it is not placed.
+    void remove(int item);
+
+    // Appends every item whose cell overlaps the rectangle.
+    void queryRect(float minX, float minZ, float maxX, float maxZ, std::vector<int>& out) const;
+
+private:
+    struct ItemSlot {
+        bool placed = false;
+        long long cell = 0;
+    };
+
+    std::unordered_map<long long, std::vector<int> > cells;
+    std::vector<ItemSlot> items;
+
+    void unlink(int item, long long cell);
+
+    static long long key(int cx, int cz) {
+        // Shift while unsigned: shifting a negative signed value is undefined
+        return (long long)((uint64_t)(uint32_t)cx << 32 | (uint32_t)cz);
+    }
+};
+
+#endif